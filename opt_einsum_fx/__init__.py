@@ -3,6 +3,19 @@ __version__ = "0.1.3"
 from ._script import jitable
 from ._opt_ein import optimize_einsums, optimize_einsums_full
 from ._fuse import fuse_einsums, fuse_scalars
+from ._factor import factor_einsums
+from ._dims import merge_einsum_dims, squeeze_einsum_dims
+from ._layout import assign_einsum_layouts
+from ._permute import fold_permutes
+from ._blocks import annotate_block_diagonal
+from ._kron import annotate_kronecker, factor_kronecker_operands
+from ._message import fuse_message_passing
+from ._codegen import compile_einsums
+from ._export import export_cpp
+from ._dynamo import opt_einsum_backend
+from ._aten import normalize_aten_ops
+from ._module import OptimizedModule
+from ._artifact import load_optimized, save_optimized
 
 __all__ = [
     "jitable",
@@ -10,4 +23,20 @@ __all__ = [
     "optimize_einsums_full",
     "fuse_einsums",
     "fuse_scalars",
+    "factor_einsums",
+    "merge_einsum_dims",
+    "squeeze_einsum_dims",
+    "assign_einsum_layouts",
+    "fold_permutes",
+    "annotate_block_diagonal",
+    "annotate_kronecker",
+    "factor_kronecker_operands",
+    "fuse_message_passing",
+    "compile_einsums",
+    "export_cpp",
+    "opt_einsum_backend",
+    "normalize_aten_ops",
+    "OptimizedModule",
+    "save_optimized",
+    "load_optimized",
 ]
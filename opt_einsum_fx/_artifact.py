@@ -0,0 +1,174 @@
+from typing import Any, Callable, Dict, Union
+import hashlib
+import os
+import warnings
+
+import opt_einsum
+import torch
+from torch import fx
+
+from ._opt_ein import optimize_einsums_full
+from ._module import _signature
+
+
+def _trace(model: Union[torch.nn.Module, Callable], tracer_class: type) -> fx.GraphModule:
+    if isinstance(model, fx.GraphModule):
+        return model
+    tracer: fx.Tracer = tracer_class()
+    graph = tracer.trace(model)
+    return fx.GraphModule(tracer.root, graph)
+
+
+def _tensor_digest(t: torch.Tensor) -> str:
+    t = t.detach().cpu().contiguous()
+    h = hashlib.sha1(repr((tuple(t.shape), t.dtype)).encode())
+    if t.dtype == torch.bfloat16:
+        # NumPy has no bfloat16, but float32 holds its values exactly
+        t = t.float()
+    # Reinterpreting as bytes with Tensor.view(dtype) needs PyTorch 1.11
+    h.update(t.numpy().tobytes())
+    return h.hexdigest()
+
+
+def _artifact_key(
+    traced: fx.GraphModule, example_inputs: tuple, optimize_kwargs: Dict[str, Any]
+) -> Dict[str, str]:
+    """The key an artifact of ``traced`` optimized for ``example_inputs`` is valid for."""
+    from . import __version__
+
+    return {
+        "graph": hashlib.sha1(traced.code.encode()).hexdigest(),
+        "inputs": repr(_signature(example_inputs)),
+        "options": repr(sorted(optimize_kwargs.items())),
+        # The loaded module is bound to the model's parameters, which must therefore fit the saved graph
+        "parameters": repr(
+            [(name, tuple(p.shape), p.dtype) for name, p in traced.named_parameters()]
+        ),
+        # Constant buffers are folded into the optimized graph, so their values matter too
+        "buffers": repr(
+            sorted(
+                (name, _tensor_digest(b))
+                for name, b in traced.named_buffers()
+                if not b.is_sparse
+            )
+        ),
+        "opt_einsum_fx": __version__,
+        "opt_einsum": opt_einsum.__version__,
+        "torch": torch.__version__,
+    }
+
+
+def _load(path: str) -> Any:
+    try:
+        return torch.load(path, weights_only=False)
+    except TypeError:
+        # Older versions of PyTorch don't have weights_only, and always load everything
+        return torch.load(path)
+
+
+def _bind_state(optimized: fx.GraphModule, traced: fx.GraphModule) -> None:
+    """Make ``optimized`` use the parameters and buffers of ``traced`` wherever it has ones of the same names.
+
+    Raises:
+        ValueError: if one of them has a different shape or dtype in ``optimized``.
+    """
+    for name, t in list(traced.named_parameters()) + list(traced.named_buffers()):
+        prefix, _, attr = name.rpartition(".")
+        owner = optimized
+        for atom in prefix.split(".") if prefix else []:
+            owner = getattr(owner, atom, None)
+            if owner is None:
+                break
+        old = getattr(owner, attr, None) if owner is not None else None
+        if not isinstance(old, torch.Tensor):
+            # Folded away by the optimization
+            continue
+        if old.shape != t.shape or old.dtype != t.dtype:
+            raise ValueError(
+                f"{name} has shape {tuple(t.shape)} and dtype {t.dtype} in the model, but {tuple(old.shape)} and {old.dtype} in the artifact"
+            )
+        setattr(owner, attr, t)
+
+
+def save_optimized(
+    path: str,
+    optimized: fx.GraphModule,
+    model: Union[torch.nn.Module, Callable],
+    example_inputs: tuple,
+    tracer_class: type = fx.Tracer,
+    **optimize_kwargs: Any,
+) -> None:
+    """Save ``optimized``, the result of ``optimize_einsums_full(model, example_inputs, **optimize_kwargs)``, as an artifact that ``load_optimized`` can use instead of optimizing again.
+
+    The artifact holds the optimized graph module --- its generated code, in which the contraction paths are fixed, and its parameters and buffers, including constants folded by the optimization --- along with the key it is valid for: a hash of ``model``'s traced graph, the signature of ``example_inputs``, the options, the names, shapes, and dtypes of ``model``'s parameters, the values of its buffers, and the versions of ``opt_einsum_fx``, ``opt_einsum``, and PyTorch.
+
+    Artifacts are pickles of the module, including its generated code, so only load them from paths that nobody untrusted can write to.
+
+    Graphs with einsums compiled by ``codegen`` can't be saved, since their operators only exist in the process that compiled them.
+
+    Args:
+        path (str): the file to write.
+        optimized (fx.GraphModule): the optimized module.
+        model (torch.nn.Module or callable): the model it was optimized from.
+        example_inputs (tuple): the example inputs it was optimized for.
+        tracer_class (type, optional): the tracer class used to trace ``model``.
+        **optimize_kwargs: the other keyword arguments it was optimized with.
+    """
+    if optimize_kwargs.get("codegen", False):
+        raise ValueError("Graphs with compiled einsums can't be saved")
+    traced = _trace(model, tracer_class)
+    torch.save(
+        {"key": _artifact_key(traced, example_inputs, optimize_kwargs), "module": optimized},
+        path,
+    )
+
+
+def load_optimized(
+    path: str,
+    model: Union[torch.nn.Module, Callable],
+    example_inputs: tuple,
+    tracer_class: type = fx.Tracer,
+    **optimize_kwargs: Any,
+) -> fx.GraphModule:
+    """Load the optimized ``model`` from the artifact at ``path``, or optimize it and save the artifact.
+
+    If ``path`` holds an artifact written by ``save_optimized`` whose key matches ``model``, ``example_inputs``, and ``optimize_kwargs`` (see ``save_optimized``), the optimized module is loaded from it without optimizing anything; ``model`` is only traced, to check the key. Otherwise, ``model`` is optimized with ``optimize_einsums_full`` and the artifact at ``path`` is replaced with the result.
+
+    Loading an artifact unpickles it with ``torch.load(weights_only=False)``, which can run arbitrary code: ``path`` must be trusted, like a Python module would be.
+
+    The loaded module uses the parameters and buffers of ``model`` itself, rather than the saved copies, so that it follows later changes to the parameters as the freshly optimized module would.
+
+    Args:
+        path (str): the artifact file, which must be trusted.
+        model (torch.nn.Module or callable): the model to optimize.
+        example_inputs (tuple): passed to ``optimize_einsums_full``.
+        tracer_class (type, optional): passed to ``optimize_einsums_full``.
+        **optimize_kwargs: other keyword arguments for ``optimize_einsums_full``.
+
+    Returns:
+        The optimized ``fx.GraphModule``.
+    """
+    traced = _trace(model, tracer_class)
+    if os.path.exists(path):
+        try:
+            artifact = _load(path)
+        except Exception as e:
+            warnings.warn(
+                f"Could not load the artifact {path}: {e}; optimizing again",
+                RuntimeWarning,
+            )
+        else:
+            if artifact.get("key", None) == _artifact_key(
+                traced, example_inputs, optimize_kwargs
+            ):
+                optimized = artifact["module"]
+                _bind_state(optimized, traced)
+                return optimized
+    optimized = optimize_einsums_full(
+        traced, example_inputs, tracer_class=tracer_class, **optimize_kwargs
+    )
+    if not optimize_kwargs.get("codegen", False):
+        save_optimized(
+            path, optimized, traced, example_inputs, tracer_class, **optimize_kwargs
+        )
+    return optimized
@@ -0,0 +1,148 @@
+from typing import Any, Optional, Set, Tuple
+import copy
+import numbers
+import operator
+import string
+
+import torch
+from torch import fx
+
+from .fx_utils import get_shape
+
+
+def _aten_ops(name: str, *overloads: str) -> Set[Any]:
+    """Get an ATen operator and some of its overloads, as far as this version of PyTorch has them."""
+    out = set()
+    try:
+        packet = getattr(torch.ops.aten, name)
+    except (AttributeError, RuntimeError):
+        return out
+    if len(overloads) == 0:
+        out.add(packet)
+    for overload in overloads:
+        if hasattr(packet, overload):
+            out.add(getattr(packet, overload))
+    return out
+
+
+_ATEN_EINSUM = _aten_ops("einsum") | _aten_ops("einsum", "default")
+_ATEN_MM = _aten_ops("mm") | _aten_ops("mm", "default")
+_ATEN_BMM = _aten_ops("bmm") | _aten_ops("bmm", "default")
+_ATEN_PERMUTE = _aten_ops("permute") | _aten_ops("permute", "default")
+_ATEN_T = _aten_ops("t") | _aten_ops("t", "default")
+_ATEN_TRANSPOSE = _aten_ops("transpose", "int")
+_ATEN_SUM = _aten_ops("sum", "dim_IntList")
+_ATEN_MUL = _aten_ops("mul", "Tensor", "Scalar")
+_ATEN_DIV = _aten_ops("div", "Tensor", "Scalar")
+_ATEN_ADD = _aten_ops("add", "Tensor")
+_ATEN_SUB = _aten_ops("sub", "Tensor")
+
+
+def _ndim(node) -> Optional[int]:
+    """The number of dimensions of ``node``, from ``ShapeProp`` or the values recorded by ``make_fx``."""
+    if not isinstance(node, fx.Node):
+        return None
+    shape = get_shape(node)
+    if shape is None:
+        val = node.meta.get("val", None)
+        if not isinstance(val, torch.Tensor):
+            return None
+        shape = val.shape
+    return len(shape)
+
+
+def _permutation_einstr(dims) -> str:
+    letters = string.ascii_lowercase[: len(dims)]
+    dims = [d % len(dims) for d in dims]
+    return letters + "->" + "".join(letters[d] for d in dims)
+
+
+def _is_scalar(x) -> bool:
+    return isinstance(x, numbers.Number) and not isinstance(x, bool)
+
+
+def _normalize(node: fx.Node) -> Optional[Tuple[Any, tuple]]:
+    """Get the target and arguments of the ``torch`` or ``operator`` call equivalent to an ATen operator call, if there is one."""
+    target, args, kwargs = node.target, node.args, node.kwargs
+    if target in _ATEN_EINSUM:
+        path = args[2] if len(args) > 2 else kwargs.get("path", None)
+        if path is not None:
+            return None
+        return torch.einsum, (args[0],) + tuple(args[1])
+    if len(kwargs) > 0:
+        # Everything else is only handled with its default keyword arguments
+        return None
+    if target in _ATEN_MM:
+        return torch.einsum, ("ij,jk->ik",) + tuple(args)
+    if target in _ATEN_BMM:
+        return torch.einsum, ("zij,zjk->zik",) + tuple(args)
+    if target in _ATEN_PERMUTE:
+        x, dims = args
+        return torch.einsum, (_permutation_einstr(dims), x)
+    if target in _ATEN_T:
+        ndim = _ndim(args[0])
+        if ndim is None:
+            return None
+        return torch.einsum, (_permutation_einstr(list(reversed(range(ndim)))), args[0])
+    if target in _ATEN_TRANSPOSE:
+        x, d0, d1 = args
+        ndim = _ndim(x)
+        if ndim is None:
+            return None
+        dims = list(range(ndim))
+        dims[d0], dims[d1] = dims[d1], dims[d0]
+        return torch.einsum, (_permutation_einstr(dims), x)
+    if target in _ATEN_SUM:
+        if len(args) > 2 and args[2]:
+            # keepdim
+            return None
+        x, dims = args[:2]
+        ndim = _ndim(x)
+        if ndim is None or dims is None:
+            return None
+        letters = string.ascii_lowercase[:ndim]
+        # Summing over no dimensions sums over all of them
+        dims = [d % ndim for d in dims] if len(dims) > 0 else range(ndim)
+        out = "".join(lab for d, lab in enumerate(letters) if d not in dims)
+        return torch.einsum, (letters + "->" + out, x)
+    if len(args) != 2:
+        return None
+    if target in _ATEN_MUL and (_is_scalar(args[0]) or _is_scalar(args[1])):
+        return operator.mul, tuple(args)
+    if target in _ATEN_DIV and _is_scalar(args[1]):
+        return operator.truediv, tuple(args)
+    if target in _ATEN_ADD:
+        return operator.add, tuple(args)
+    if target in _ATEN_SUB:
+        return operator.sub, tuple(args)
+    return None
+
+
+def normalize_aten_ops(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+    """Rewrite ATen operator calls as the ``torch`` and ``operator`` calls that the other passes understand.
+
+    Graphs traced with ``make_fx`` or AOTAutograd --- including backward and double-backward graphs of functions that call ``torch.autograd.grad`` --- are made of ATen operators like ``aten.mm.default``. This turns ``aten.einsum``, ``aten.mm``, ``aten.bmm``, ``aten.permute``, ``aten.t``, ``aten.transpose``, and ``aten.sum`` over dimensions into einsums; multiplications and divisions by constant scalars into ``operator.mul`` and ``operator.truediv``; and additions and subtractions without ``alpha`` into ``operator.add`` and ``operator.sub``.
+
+    ``aten.t``, ``aten.transpose``, and ``aten.sum`` need the number of dimensions of their operands, from shape information such as that populated by ``ShapeProp`` or from the values ``make_fx`` records; without it they are left alone.
+
+    Args:
+        graph: the graph to process.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The normalized graph.
+    """
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    for node in graph.nodes:
+        if node.op != "call_function":
+            continue
+        new = _normalize(node)
+        if new is None:
+            continue
+        node.target, node.args = new
+        node.kwargs = {}
+
+    graph.lint()
+    return graph
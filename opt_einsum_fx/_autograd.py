@@ -0,0 +1,60 @@
+from typing import List, Optional, Sequence, Tuple
+
+import opt_einsum
+import torch
+
+
+class _FusedEinsum(torch.autograd.Function):
+    """An einsum contracted along a fixed path, whose gradients are einsums contracted along their own paths."""
+
+    @staticmethod
+    def forward(ctx, equation, path, grad_equations, grad_paths, *operands):
+        ctx.grad_equations = grad_equations
+        ctx.grad_paths = grad_paths
+        # Only the inputs are saved; the backward recomputes whatever intermediates it needs
+        ctx.save_for_backward(*operands)
+        return opt_einsum.contract(equation, *operands, optimize=list(path))
+
+    @staticmethod
+    def backward(ctx, grad_out):
+        operands = ctx.saved_tensors
+        grads: List[Optional[torch.Tensor]] = [None] * 4
+        for i in range(len(operands)):
+            if not ctx.needs_input_grad[4 + i]:
+                grads.append(None)
+                continue
+            others = operands[:i] + operands[i + 1:]
+            grads.append(
+                opt_einsum.contract(
+                    ctx.grad_equations[i],
+                    grad_out,
+                    *others,
+                    optimize=list(ctx.grad_paths[i]),
+                )
+            )
+        return tuple(grads)
+
+
+def _fused_einsum(
+    equation: str,
+    path: Sequence[Tuple[int, ...]],
+    grad_equations: Sequence[str],
+    grad_paths: Sequence[Sequence[Tuple[int, ...]]],
+    *operands: torch.Tensor,
+) -> torch.Tensor:
+    """Contract ``operands`` along ``path``, with the gradient of ``operands[i]`` contracted by ``grad_equations[i]`` along ``grad_paths[i]``."""
+    return _FusedEinsum.apply(equation, path, grad_equations, grad_paths, *operands)
+
+
+def _grad_equations(input_subscripts: Sequence[str], output_subscript: str) -> Optional[List[str]]:
+    """Get the einsum that computes the gradient of each operand of an einsum from the gradient of its output and the other operands, or ``None`` if some gradient isn't an einsum.
+
+    That's the case when an operand has a repeated index, or an index that no other operand or the output has, since its gradient is then broadcast along a diagonal or a dimension.
+    """
+    out = []
+    for i, labels in enumerate(input_subscripts):
+        others = [output_subscript] + list(input_subscripts[:i]) + list(input_subscripts[i + 1:])
+        if len(set(labels)) != len(labels) or not set(labels) <= set("".join(others)):
+            return None
+        out.append(",".join(others) + "->" + labels)
+    return out
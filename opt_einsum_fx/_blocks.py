@@ -0,0 +1,155 @@
+from typing import List, Optional, Sequence, Tuple
+
+import torch
+from torch import fx
+
+from ._contract import _Tensor
+from ._sparse import _fetch_attr
+
+# Operands with at most this fraction of their entries in diagonal blocks are contracted block by block
+_BLOCK_MAX_DENSITY: float = 0.5
+
+_BLOCKS_ATTR: str = "_opt_einsum_fx_blocks"
+
+
+def annotate_block_diagonal(
+    tensor: torch.Tensor, row_sizes: Sequence[int], col_sizes: Sequence[int]
+) -> torch.Tensor:
+    """Declare that a matrix is, and will stay, block diagonal.
+
+    ``optimize_einsums`` detects block-diagonal constant buffers by itself, but can't know that a parameter will keep its zeros through training. Parameters annotated with this function are contracted one diagonal block at a time, skipping the zero blocks entirely, with the gradients of the off-diagonal blocks being zero as a consequence.
+
+    Example:
+        .. code-block:: python
+
+            self.weight = torch.nn.Parameter(torch.block_diag(torch.randn(4, 3), torch.randn(4, 3)))
+            annotate_block_diagonal(self.weight, [4, 4], [3, 3])
+
+    Args:
+        tensor: a matrix, usually a ``torch.nn.Parameter``.
+        row_sizes: the number of rows of each diagonal block.
+        col_sizes: the number of columns of each diagonal block.
+
+    Returns:
+        ``tensor``.
+    """
+    if tensor.dim() != 2:
+        raise ValueError("Only matrices can be annotated as block diagonal")
+    if len(row_sizes) != len(col_sizes):
+        raise ValueError("There must be as many row sizes as column sizes")
+    if sum(row_sizes) != tensor.shape[0] or sum(col_sizes) != tensor.shape[1]:
+        raise ValueError(
+            f"Blocks of sizes {list(zip(row_sizes, col_sizes))} don't tile a matrix of shape {tuple(tensor.shape)}"
+        )
+    setattr(tensor, _BLOCKS_ATTR, (tuple(row_sizes), tuple(col_sizes)))
+    return tensor
+
+
+def _find_blocks(value: torch.Tensor) -> Optional[Tuple[Tuple[int, ...], Tuple[int, ...]]]:
+    """Find the finest partition of a matrix into diagonal blocks outside of which it is zero."""
+    nonzero = value != 0
+    n_rows, n_cols = nonzero.shape
+    cols = torch.arange(n_cols)
+    # The first and last nonzero column in each row, or n_cols and -1 for empty rows
+    cols = cols.expand(n_rows, n_cols)
+    first = cols.masked_fill(~nonzero, n_cols).min(dim=1).values.tolist()
+    last = cols.masked_fill(~nonzero, -1).max(dim=1).values.tolist()
+    # The first nonzero column in any row from each row on
+    first_after = list(first)
+    for i in reversed(range(n_rows - 1)):
+        first_after[i] = min(first_after[i], first_after[i + 1])
+    row_sizes: List[int] = []
+    col_sizes: List[int] = []
+    row_start, col_start, col_end = 0, 0, 0
+    for i in range(n_rows):
+        col_end = max(col_end, last[i] + 1)
+        if i + 1 < n_rows and first_after[i + 1] >= col_end and col_end > col_start:
+            # Everything below and left of here, and above and right of here, is zero
+            row_sizes.append(i + 1 - row_start)
+            col_sizes.append(col_end - col_start)
+            row_start, col_start = i + 1, col_end
+    row_sizes.append(n_rows - row_start)
+    col_sizes.append(n_cols - col_start)
+    if len(row_sizes) < 2 or col_sizes[-1] == 0:
+        return None
+    return tuple(row_sizes), tuple(col_sizes)
+
+
+class _BlockDiagonal:
+    """A block-diagonal matrix operand."""
+
+    def __init__(self, row_sizes: Sequence[int], col_sizes: Sequence[int]):
+        self.row_sizes = tuple(row_sizes)
+        self.col_sizes = tuple(col_sizes)
+        self.density = sum(r * c for r, c in zip(row_sizes, col_sizes)) / (
+            sum(row_sizes) * sum(col_sizes)
+        )
+
+    def supports(self, roles) -> bool:
+        return len(roles.left) == 1 and len(roles.contracted) == 1
+
+    def matmul(self, graph: fx.Graph, s: _Tensor, roles, x: fx.Node) -> fx.Node:
+        """Emit the product of the block-diagonal ``s`` and the matrix ``x`` as a single ``bmm`` if the blocks are all the same size, or one ``mm`` per block otherwise."""
+        # Is the matrix stored with the contracted index first?
+        transposed = s.labels.index(roles.left) == 1
+        if transposed:
+            rows, cols = self.col_sizes, self.row_sizes
+        else:
+            rows, cols = self.row_sizes, self.col_sizes
+        n_blocks = len(rows)
+        if len(set(rows)) == 1 and len(set(cols)) == 1:
+            r, c = rows[0], cols[0]
+            # The diagonal blocks of a block-diagonal matrix are a diagonal of a view of it
+            if transposed:
+                w = graph.call_method("reshape", (s.node, (n_blocks, c, n_blocks, r)))
+            else:
+                w = graph.call_method("reshape", (s.node, (n_blocks, r, n_blocks, c)))
+            # Both block indices go last; the block sizes are left in storage order
+            w = graph.call_function(torch.diagonal, (w,), {"dim1": 0, "dim2": 2})
+            w = graph.call_method("permute", (w, 2, 1, 0) if transposed else (w, 2, 0, 1))
+            x = graph.call_method("reshape", (x, (n_blocks, c, -1)))
+            out = graph.call_function(torch.bmm, (w, x))
+            return graph.call_method("reshape", (out, (n_blocks * r, -1)))
+        pieces = []
+        row_start, col_start = 0, 0
+        for r, c in zip(rows, cols):
+            if transposed:
+                w = graph.call_method("narrow", (s.node, 0, col_start, c))
+                w = graph.call_method("narrow", (w, 1, row_start, r))
+                w = graph.call_method("t", (w,))
+            else:
+                w = graph.call_method("narrow", (s.node, 0, row_start, r))
+                w = graph.call_method("narrow", (w, 1, col_start, c))
+            xk = graph.call_method("narrow", (x, 0, col_start, c))
+            pieces.append(graph.call_function(torch.mm, (w, xk)))
+            row_start += r
+            col_start += c
+        return graph.call_function(torch.cat, (pieces, 0))
+
+
+def _get_block_diagonal(node: fx.Node) -> Optional[_BlockDiagonal]:
+    """If ``node`` is an annotated or constant block-diagonal matrix, get its blocks."""
+    if not isinstance(node, fx.Node) or node.op != "get_attr":
+        return None
+    owner = getattr(node.graph, "owning_module", None)
+    if owner is None:
+        return None
+    value = _fetch_attr(owner, node.target)
+    if not isinstance(value, torch.Tensor) or value.dim() != 2:
+        return None
+    blocks = getattr(value, _BLOCKS_ATTR, None)
+    if blocks is None:
+        if (
+            isinstance(value, torch.nn.Parameter)
+            or value.requires_grad
+            or value.layout != torch.strided
+        ):
+            # Parameters can change, so their structure has to be declared
+            return None
+        blocks = _find_blocks(value)
+        if blocks is None:
+            return None
+    out = _BlockDiagonal(*blocks)
+    if out.density > _BLOCK_MAX_DENSITY:
+        return None
+    return out
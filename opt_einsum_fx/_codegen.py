@@ -0,0 +1,273 @@
+from typing import Any, Dict, List, Sequence, Tuple
+import copy
+import hashlib
+import warnings
+
+import torch
+from torch import fx
+
+from ._contract import _contiguous_stride
+from ._cost import _contract_path, _get_contract_kwargs
+from ._fuse import _is_einsum, prod
+from .fx_utils import get_dtype, get_shape
+
+# Einsums whose optimal contraction takes at most this many operations are compiled
+_CODEGEN_MAX_FLOPS: int = 2 ** 16
+
+# The C++ type and ATen scalar type of each supported dtype
+_CODEGEN_DTYPES = {
+    torch.float32: ("float", "torch::kFloat"),
+    torch.float64: ("double", "torch::kDouble"),
+}
+
+# Compiled operators by name, so that every kernel is only built once per process
+_COMPILED: Dict[str, Any] = {}
+
+
+def _var(lab: str) -> str:
+    return f"i{ord(lab)}"
+
+
+def _offset(labels: str, sizes: Dict[str, int]) -> str:
+    """The C++ expression for the offset of an element of a contiguous tensor with indices ``labels``."""
+    stride = _contiguous_stride(tuple(sizes[lab] for lab in labels))
+    terms = [f"{_var(lab)} * {s}" for lab, s in zip(labels, stride)]
+    return " + ".join(terms) if len(terms) > 0 else "0"
+
+
+def _kernel_source(
+    input_subscripts: Sequence[str],
+    sizes: Dict[str, int],
+    contraction_list: Sequence[tuple],
+    scalar: str,
+) -> str:
+    """Generate a C++ function ``kernel`` that computes a contraction as a loop nest per step, with every size a constant.
+
+    The function takes a pointer to each contiguous operand and to the contiguous output.
+    """
+    names = [f"in{i}" for i in range(len(input_subscripts))]
+    params = [f"const {scalar}* {name}" for name in names] + [f"{scalar}* out"]
+    lines = [f"void kernel({', '.join(params)}) {{"]
+    for k, (inds, _, einsum_str, _, _) in enumerate(contraction_list):
+        popped = [names.pop(x) for x in inds]
+        inputs, result = einsum_str.split("->")
+        inputs = inputs.split(",")
+        if k == len(contraction_list) - 1:
+            dst = "out"
+        else:
+            dst = f"t{k}"
+            lines.append(
+                f"  std::vector<{scalar}> {dst}_buf({prod(sizes[lab] for lab in result)});"
+            )
+            lines.append(f"  {scalar}* {dst} = {dst}_buf.data();")
+        summed = "".join(
+            lab for lab in dict.fromkeys("".join(inputs)) if lab not in result
+        )
+        indent = "  "
+        for lab in result:
+            lines.append(
+                f"{indent}for (int64_t {_var(lab)} = 0; {_var(lab)} < {sizes[lab]}; ++{_var(lab)}) {{"
+            )
+            indent += "  "
+        lines.append(f"{indent}{scalar} acc = 0;")
+        inner = indent
+        for lab in summed:
+            lines.append(
+                f"{inner}for (int64_t {_var(lab)} = 0; {_var(lab)} < {sizes[lab]}; ++{_var(lab)}) {{"
+            )
+            inner += "  "
+        product = " * ".join(
+            f"{name}[{_offset(labels, sizes)}]" for name, labels in zip(popped, inputs)
+        )
+        lines.append(f"{inner}acc += {product};")
+        for _ in summed:
+            inner = inner[:-2]
+            lines.append(f"{inner}}}")
+        lines.append(f"{indent}{dst}[{_offset(result, sizes)}] = acc;")
+        for _ in result:
+            indent = indent[:-2]
+            lines.append(f"{indent}}}")
+        names.append(dst)
+    lines.append("}")
+    return "\n".join(lines)
+
+
+def _operator_source(
+    kernel: str,
+    shapes: Sequence[Tuple[int, ...]],
+    out_shape: Tuple[int, ...],
+    dtype: torch.dtype,
+) -> str:
+    """Generate the source of a function ``contract`` that checks its operands and calls ``kernel``."""
+    scalar, aten_type = _CODEGEN_DTYPES[dtype]
+    args = ", ".join(f"const torch::Tensor& in{i}" for i in range(len(shapes)))
+    lines = [
+        "#include <torch/extension.h>",
+        "#include <vector>",
+        "",
+        # Every operator's library has these functions, so they must stay local to it
+        "namespace {",
+        "",
+        kernel,
+        "",
+        f"torch::Tensor contract({args}) {{",
+    ]
+    for i, shape in enumerate(shapes):
+        lines += [
+            f"  TORCH_CHECK(in{i}.device().is_cpu() && in{i}.scalar_type() == {aten_type} && in{i}.sizes().vec() == std::vector<int64_t>{{{', '.join(map(str, shape))}}},",
+            f'              "operand {i} must be a CPU tensor of dtype {dtype} and shape {tuple(shape)}");',
+            f"  torch::Tensor c{i} = in{i}.contiguous();",
+        ]
+    pointers = [f"c{i}.data_ptr<{scalar}>()" for i in range(len(shapes))]
+    lines += [
+        f"  torch::Tensor out = torch::empty(std::vector<int64_t>{{{', '.join(map(str, out_shape))}}}, c0.options());",
+        f"  kernel({', '.join(pointers + [f'out.data_ptr<{scalar}>()'])});",
+        "  return out;",
+        "}",
+        "",
+        "}  // namespace",
+    ]
+    return "\n".join(lines) + "\n"
+
+
+def _batched_matmul_source(rows: int, inner: int, cols: int, dtype: torch.dtype) -> str:
+    """Generate the source of a function ``contract`` that multiplies a batch of ``rows x inner`` matrices by a batch of ``inner x cols`` ones, with the matrix sizes known at compile time and the batch size at runtime."""
+    scalar, aten_type = _CODEGEN_DTYPES[dtype]
+    lines = [
+        "#include <torch/extension.h>",
+        "#include <ATen/Parallel.h>",
+        "",
+        "namespace {",
+        "",
+        f"constexpr int64_t kRows = {rows};",
+        f"constexpr int64_t kInner = {inner};",
+        f"constexpr int64_t kCols = {cols};",
+        "",
+        "torch::Tensor contract(const torch::Tensor& a, const torch::Tensor& b) {",
+        f"  TORCH_CHECK(a.device().is_cpu() && a.scalar_type() == {aten_type} && a.dim() == 3 && a.size(1) == kRows && a.size(2) == kInner,",
+        f'              "operand 0 must be a CPU tensor of dtype {dtype} and shape (batch, {rows}, {inner})");',
+        f"  TORCH_CHECK(b.device().is_cpu() && b.scalar_type() == {aten_type} && b.dim() == 3 && b.size(0) == a.size(0) && b.size(1) == kInner && b.size(2) == kCols,",
+        f'              "operand 1 must be a CPU tensor of dtype {dtype} and shape (batch, {inner}, {cols})");',
+        "  torch::Tensor ca = a.contiguous();",
+        "  torch::Tensor cb = b.contiguous();",
+        "  const int64_t batch = ca.size(0);",
+        "  torch::Tensor out = torch::empty({batch, kRows, kCols}, ca.options());",
+        f"  const {scalar}* pa = ca.data_ptr<{scalar}>();",
+        f"  const {scalar}* pb = cb.data_ptr<{scalar}>();",
+        f"  {scalar}* po = out.data_ptr<{scalar}>();",
+        # Each batch element is too small to be worth splitting, so the batch is split across threads
+        "  at::parallel_for(0, batch, 1024, [&](int64_t begin, int64_t end) {",
+        "    for (int64_t z = begin; z < end; ++z) {",
+        f"      const {scalar}* x = pa + z * kRows * kInner;",
+        f"      const {scalar}* y = pb + z * kInner * kCols;",
+        f"      {scalar}* o = po + z * kRows * kCols;",
+        "      for (int64_t i = 0; i < kRows; ++i) {",
+        "        for (int64_t j = 0; j < kCols; ++j) {",
+        f"          {scalar} acc = 0;",
+        "          for (int64_t k = 0; k < kInner; ++k) {",
+        "            acc += x[i * kInner + k] * y[k * kCols + j];",
+        "          }",
+        "          o[i * kCols + j] = acc;",
+        "        }",
+        "      }",
+        "    }",
+        "  });",
+        "  return out;",
+        "}",
+        "",
+        "}  // namespace",
+    ]
+    return "\n".join(lines) + "\n"
+
+
+def _compile(source: str):
+    """Build the function ``contract`` in ``source`` into an operator ``torch.ops.<name>.contract``, named for a hash of ``source``, and get it."""
+    name = "opt_einsum_fx_" + hashlib.sha1(source.encode()).hexdigest()[:16]
+    if name not in _COMPILED:
+        from torch.utils.cpp_extension import load_inline
+
+        load_inline(
+            name=name,
+            cpp_sources=[
+                source
+                + f'\nTORCH_LIBRARY({name}, m) {{ m.def("contract", &contract); }}\n'
+            ],
+            is_python_module=False,
+            extra_cflags=["-O3"],
+        )
+        _COMPILED[name] = getattr(getattr(torch.ops, name), "contract")
+    return _COMPILED[name]
+
+
+def compile_einsums(
+    graph: fx.Graph,
+    contract_kwargs: dict = {},
+    max_flops: int = _CODEGEN_MAX_FLOPS,
+    in_place: bool = False,
+) -> fx.Graph:
+    """Replace small einsums with compiled C++ kernels.
+
+    For small operands, the Python and dispatcher overhead of the several operations ``optimize_einsums`` emits for an einsum can cost more than the arithmetic. Every einsum whose optimal contraction takes at most ``max_flops`` operations is instead compiled, with ``torch.utils.cpp_extension.load_inline``, into a single operator: a loop nest for each step of the ``opt_einsum`` path, with all sizes known at compile time. The operators are registered with the dispatcher as ``torch.ops.opt_einsum_fx_<hash>.contract``, so the graph stays TorchScript compatible.
+
+    The compiled operators only support CPU tensors of dtype ``float32`` or ``float64`` with exactly the shapes seen by ``ShapeProp``, and check this when called. They have no derivatives, so this is for inference only. Einsums that can't be compiled --- for example if there is no C++ compiler --- are left alone with a warning.
+
+    Args:
+        graph: the graph to process.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
+        max_flops (int, optional): the largest cost, as estimated by ``opt_einsum``, of an einsum to compile.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with compiled einsums.
+    """
+    contract_kwargs = _get_contract_kwargs(contract_kwargs)
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    for node in graph.nodes:
+        if not _is_einsum(node) or "..." in node.args[0]:
+            continue
+        args = list(node.args[1:])
+        if not all(isinstance(a, fx.Node) for a in args):
+            continue
+        shapes = [get_shape(a) for a in args]
+        out_shape = get_shape(node)
+        dtypes = set(get_dtype(a) for a in args + [node])
+        if (
+            out_shape is None
+            or any(s is None for s in shapes)
+            or len(dtypes) != 1
+            or next(iter(dtypes)) not in _CODEGEN_DTYPES
+        ):
+            continue
+        shapes = [tuple(int(n) for n in s) for s in shapes]
+        _, path_info = _contract_path(node.args[0], shapes, contract_kwargs)
+        if path_info.opt_cost > max_flops:
+            continue
+        sizes: Dict[str, int] = {}
+        input_subscripts: List[str] = path_info.input_subscripts.split(",")
+        consistent = True
+        for labels, shape in zip(input_subscripts, shapes):
+            for lab, n in zip(labels, shape):
+                consistent = consistent and sizes.setdefault(lab, n) == n
+        if not consistent:
+            # The kernels don't broadcast size-1 dimensions
+            continue
+        dtype = next(iter(dtypes))
+        kernel = _kernel_source(
+            input_subscripts, sizes, path_info.contraction_list, _CODEGEN_DTYPES[dtype][0]
+        )
+        out_shape = tuple(int(n) for n in out_shape)
+        try:
+            op = _compile(_operator_source(kernel, shapes, out_shape, dtype))
+        except Exception as e:
+            warnings.warn(
+                f"Could not compile einsum {repr(node)}: {e}; not compiling it",
+                RuntimeWarning,
+            )
+            continue
+        node.target = op
+        node.args = tuple(args)
+
+    graph.lint()
+    return graph
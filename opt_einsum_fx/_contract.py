@@ -0,0 +1,186 @@
+from typing import Any, Callable, Dict, List, NamedTuple, Optional, Sequence, Tuple
+
+import torch
+from torch import fx
+
+
+class _Tensor(NamedTuple):
+    """A tensor in the new graph together with what we know about it while emitting a contraction."""
+
+    node: Any
+    labels: str
+    shape: Tuple[int, ...]
+    stride: Tuple[int, ...]
+
+
+def _contiguous_stride(shape: Sequence[int]) -> Tuple[int, ...]:
+    stride = []
+    acc = 1
+    for n in reversed(shape):
+        stride.append(acc)
+        acc *= max(n, 1)
+    return tuple(reversed(stride))
+
+
+def _permute_tensor(graph: fx.Graph, t: _Tensor, labels: str) -> _Tensor:
+    """Permute ``t`` so that its dimensions are labeled ``labels``; a no-op if they already are."""
+    if labels == t.labels:
+        return t
+    perm = tuple(t.labels.index(lab) for lab in labels)
+    return _Tensor(
+        node=graph.call_method("permute", (t.node,) + perm),
+        labels=labels,
+        shape=tuple(t.shape[i] for i in perm),
+        stride=tuple(t.stride[i] for i in perm),
+    )
+
+
+def _einsum_tensor(graph: fx.Graph, operands: Sequence[_Tensor], out: str) -> _Tensor:
+    """Contract ``operands`` with a plain ``torch.einsum`` using their current labels."""
+    sizes: Dict[str, int] = {}
+    for t in operands:
+        for lab, n in zip(t.labels, t.shape):
+            sizes[lab] = max(sizes.get(lab, 1), n)
+    shape = tuple(sizes[lab] for lab in out)
+    return _Tensor(
+        node=graph.call_function(
+            torch.einsum,
+            (",".join(t.labels for t in operands) + "->" + out,)
+            + tuple(t.node for t in operands),
+        ),
+        labels=out,
+        shape=shape,
+        stride=_contiguous_stride(shape),
+    )
+
+
+def _emit_opt_einsum_step(
+    graph: fx.Graph, operands: Sequence[_Tensor], contraction: tuple
+) -> _Tensor:
+    """Emit one step of a contraction exactly as ``opt_einsum.contract`` would with the ``torch`` backend."""
+    _, idx_rm, einsum_str, _, blas_flag = contraction
+    input_str, results_index = einsum_str.split("->")
+    if blas_flag and "EINSUM" not in blas_flag:
+        input_left, input_right = input_str.split(",")
+        tensor_result = "".join(s for s in input_left + input_right if s not in idx_rm)
+        if idx_rm:
+            # Find indices to contract over
+            left_pos, right_pos = [], []
+            for s in idx_rm:
+                left_pos.append(input_left.find(s))
+                right_pos.append(input_right.find(s))
+            # Construct the axes tuples in a canonical order
+            axes = tuple(zip(*sorted(zip(left_pos, right_pos))))
+        else:
+            axes = ((), ())
+        a, b = operands
+        shape = tuple(
+            n
+            for t, inp in ((a, input_left), (b, input_right))
+            for lab, n in zip(inp, t.shape)
+            if lab not in idx_rm
+        )
+        new = _Tensor(
+            node=graph.call_function(
+                torch.tensordot, (a.node, b.node), {"dims": axes}
+            ),
+            labels=tensor_result,
+            shape=shape,
+            stride=_contiguous_stride(shape),
+        )
+        # Build a new view if needed
+        return _permute_tensor(graph, new, results_index)
+    else:
+        return _einsum_tensor(
+            graph,
+            [t._replace(labels=inp) for t, inp in zip(operands, input_str.split(","))],
+            results_index,
+        )
+
+
+def _step_consumers(
+    contraction_list: Sequence[tuple], n_inputs: int
+) -> List[Optional[Tuple[int, int]]]:
+    """For each step, find the step that consumes its result and the position of the result among that step's operands."""
+    ids: List[Any] = list(range(n_inputs))
+    consumers: List[Optional[Tuple[int, int]]] = [None] * len(contraction_list)
+    for num, contraction in enumerate(contraction_list):
+        popped = [ids.pop(x) for x in contraction[0]]
+        for pos, i in enumerate(popped):
+            if isinstance(i, tuple):
+                consumers[i[1]] = (num, pos)
+        ids.append(("step", num))
+    return consumers
+
+
+def _emit_contraction(
+    graph: fx.Graph,
+    operands: List[_Tensor],
+    contraction_list: Sequence[tuple],
+    output_subscript: str,
+    emit_step: Optional[Callable[..., _Tensor]] = None,
+) -> _Tensor:
+    """Emit the steps of an ``opt_einsum`` contraction into ``graph``.
+
+    Args:
+        graph: the graph to add the contraction to.
+        operands: the inputs, labeled with the einsum's input subscripts.
+        contraction_list: the ``contraction_list`` of the ``PathInfo`` for the contraction.
+        output_subscript: the einsum's output subscript.
+        emit_step: a function ``emit_step(graph, operands, contraction, prefer)`` that emits a single step; ``prefer`` maps a candidate label order for the step's result to a cost for the steps that follow. If ``None``, steps are emitted like ``opt_einsum.contract`` would.
+
+    Returns:
+        The result.
+    """
+    consumers = _step_consumers(contraction_list, len(operands))
+    operands = list(operands)
+    for num, contraction in enumerate(contraction_list):
+        tmp_operands = [operands.pop(x) for x in contraction[0]]
+        if emit_step is None:
+            new = _emit_opt_einsum_step(graph, tmp_operands, contraction)
+        else:
+            new = emit_step(
+                graph,
+                tmp_operands,
+                contraction,
+                _make_prefer(contraction_list, consumers[num], output_subscript),
+            )
+        operands.append(new)
+    return _permute_tensor(graph, operands[0], output_subscript)
+
+
+def _make_prefer(
+    contraction_list: Sequence[tuple],
+    consumer: Optional[Tuple[int, int]],
+    output_subscript: str,
+) -> Callable[[str], int]:
+    """Make the cost function for the label order of a step's result."""
+    if consumer is None:
+        # This is the final result: we'd like it to come out in the right order
+        return lambda labels: int(labels != output_subscript)
+    num, pos = consumer
+    input_str, results_index = contraction_list[num][2].split("->")
+    others = set(
+        "".join(inp for i, inp in enumerate(input_str.split(",")) if i != pos)
+    )
+    return lambda labels: _consumer_cost(labels, others, set(results_index))
+
+
+def _consumer_cost(labels: str, others: set, keep: set) -> int:
+    """Estimate whether a contiguous tensor labeled ``labels`` needs a copy to be multiplied, as a matrix, with operands labeled ``others``, keeping the indices ``keep``."""
+
+    def group(lab):
+        if lab in others:
+            return "batch" if lab in keep else "contracted"
+        # Indices only this operand has and that aren't kept are summed out first
+        return "free" if lab in keep else None
+
+    groups = [g for g in map(group, labels) if g is not None]
+    runs = [g for i, g in enumerate(groups) if i == 0 or groups[i - 1] != g]
+    if len(runs) != len(set(runs)):
+        # Some group of indices isn't contiguous, so it can't be flattened without a copy
+        return 1
+    if len(runs) > 1 and runs[-1] == "batch":
+        # Neither matrix dimension is the contiguous one
+        return 1
+    return 0
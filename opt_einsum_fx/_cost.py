@@ -0,0 +1,86 @@
+from collections import OrderedDict
+from typing import Hashable, List, Optional, Sequence, Tuple
+import threading
+
+import opt_einsum
+import torch
+from torch import fx
+
+from ._hash import _canonical_einsum
+from .fx_utils import get_shape
+
+_DEFAULT_CONTRACT_KWARGS = {
+    "optimize": "optimal",
+}
+
+# The most contraction paths to remember
+_PATH_CACHE_SIZE: int = 4096
+
+# Contraction paths by canonical einsum, shapes, and options, so that every copy of a repeated block is searched once
+_PATH_CACHE: "OrderedDict[Hashable, List[Tuple[int, ...]]]" = OrderedDict()
+_PATH_CACHE_LOCK = threading.Lock()
+
+
+def _get_contract_kwargs(contract_kwargs: dict) -> dict:
+    """Fill in our defaults for ``opt_einsum.contract_path`` keyword arguments."""
+    out = dict(_DEFAULT_CONTRACT_KWARGS)
+    out.update(contract_kwargs)
+    return out
+
+
+def _contract_path(einstr: str, shapes: Sequence, contract_kwargs: dict):
+    """``opt_einsum.contract_path`` for ``shapes``, remembering the paths it finds.
+
+    Einsums that only differ in the names of their indices share paths, so the path search --- the expensive part --- is only done once for each. Only searches with a named optimizer and hashable options are remembered; optimizer objects may be stateful.
+    """
+    key = None
+    if isinstance(contract_kwargs.get("optimize", None), str):
+        key = (_canonical_einsum(einstr, shapes), tuple(sorted(contract_kwargs.items())))
+        try:
+            hash(key)
+        except TypeError:
+            key = None
+    if key is not None:
+        with _PATH_CACHE_LOCK:
+            path = _PATH_CACHE.get(key, None)
+            if path is not None:
+                _PATH_CACHE.move_to_end(key)
+        if path is not None:
+            # Following a given path is cheap, and gives the ``PathInfo`` with this einsum's index names
+            return opt_einsum.contract_path(einstr, *shapes, shapes=True, optimize=path)
+    path, path_info = opt_einsum.contract_path(
+        einstr, *shapes, shapes=True, **contract_kwargs
+    )
+    if key is not None:
+        with _PATH_CACHE_LOCK:
+            _PATH_CACHE[key] = path
+            if len(_PATH_CACHE) > _PATH_CACHE_SIZE:
+                _PATH_CACHE.popitem(last=False)
+    return path, path_info
+
+
+def einsum_cost(
+    einstr: str, shapes: Sequence[torch.Size], contract_kwargs: dict = {}
+) -> int:
+    """Get the ``opt_einsum`` cost of contracting ``einstr`` for operands of shapes ``shapes``.
+
+    Args:
+        einstr (str): the einsum string.
+        shapes: the shapes of the operands.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
+
+    Returns:
+        The cost (roughly, the number of FLOPs) of the contraction along the path ``opt_einsum`` would choose.
+    """
+    _, path_info = _contract_path(einstr, shapes, _get_contract_kwargs(contract_kwargs))
+    return int(path_info.opt_cost)
+
+
+def _einsum_args_cost(
+    einstr: str, args: Sequence[fx.Node], contract_kwargs: dict
+) -> Optional[int]:
+    """Get the cost of an einsum over the nodes ``args``, or ``None`` if they lack shape information."""
+    shapes = [get_shape(a) if isinstance(a, fx.Node) else None for a in args]
+    if any(s is None for s in shapes):
+        return None
+    return einsum_cost(einstr, shapes, contract_kwargs)
@@ -0,0 +1,341 @@
+from typing import Dict, List, Optional, Sequence
+import copy
+import operator
+
+import torch
+from torch import fx
+
+from ._fuse import _get_einstrs, _is_einsum
+from .fx_utils import get_shape, get_stride
+
+
+def _can_view_merge(sizes: Sequence[int], strides: Sequence[int]) -> bool:
+    """Whether consecutive dimensions with ``sizes`` and ``strides`` can be viewed as a single dimension."""
+    dims = [(n, s) for n, s in zip(sizes, strides) if n != 1]
+    return all(
+        dims[i][1] == dims[i + 1][1] * dims[i + 1][0] for i in range(len(dims) - 1)
+    )
+
+
+def _known_stride(node) -> Optional[tuple]:
+    """The strides of ``node``, unless they are made up: ``ShapeProp`` records einsum and tensordot results as contiguous without computing them, while the real results can be laid out any way."""
+    if not isinstance(node, fx.Node):
+        return None
+    if _is_einsum(node) or (node.op == "call_function" and node.target is torch.tensordot):
+        return None
+    return get_stride(node)
+
+
+def _co_occurring_groups(terms: Sequence[str]) -> List[str]:
+    """Find maximal runs of labels that always appear together, adjacent and in the same order, in ``terms``."""
+    repeated = set(lab for t in terms for lab in t if t.count(lab) > 1)
+    occurs_in = {
+        lab: frozenset(i for i, t in enumerate(terms) if lab in t)
+        for lab in set("".join(terms))
+    }
+    successor: Dict[str, str] = {}
+    for lab in occurs_in:
+        if lab in repeated:
+            continue
+        nexts = set()
+        for t in terms:
+            pos = t.find(lab)
+            if pos == -1:
+                continue
+            nexts.add(t[pos + 1] if pos + 1 < len(t) else None)
+        if len(nexts) != 1:
+            continue
+        nxt = nexts.pop()
+        if nxt is None or nxt in repeated or occurs_in[nxt] != occurs_in[lab]:
+            continue
+        successor[lab] = nxt
+    heads = set(successor.keys()) - set(successor.values())
+    groups = []
+    for head in sorted(heads):
+        group = head
+        while group[-1] in successor:
+            group += successor[group[-1]]
+        groups.append(group)
+    return groups
+
+
+def _split_for_views(
+    group: str, operands: Sequence[Optional[tuple]], inp_einstrs: Sequence[str]
+) -> List[str]:
+    """Split ``group`` into the longest runs that can be merged with a view in every operand."""
+    out = []
+    cur = group[0]
+    for lab in group[1:]:
+        candidate = cur + lab
+        ok = True
+        for (shape, stride), es in zip(operands, inp_einstrs):
+            pos = es.find(candidate)
+            if pos == -1:
+                continue
+            if not _can_view_merge(
+                shape[pos:pos + len(candidate)], stride[pos:pos + len(candidate)]
+            ):
+                ok = False
+                break
+        if ok:
+            cur = candidate
+        else:
+            out.append(cur)
+            cur = lab
+    out.append(cur)
+    return [g for g in out if len(g) > 1]
+
+
+def merge_einsum_dims(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+    """Merge indices that always occur together in einsums into single indices.
+
+    If, in some einsum, a group of indices always appears in the same adjacent order in every operand and in the output --- like ``j`` and ``k`` in ``"ijk,jkl->il"`` --- the group can be flattened into a single index with a ``reshape`` of each operand and of the output. This gives ``opt_einsum`` fewer, larger dimensions to work with that map more directly onto matrix multiplications.
+
+    Groups are only merged when every operand's strides allow the ``reshape`` to be a view, so no copies are introduced. This requires shape and stride information such as that populated by ``ShapeProp``; einsums without it, or with operands that are results of other einsums, whose strides ``ShapeProp`` doesn't know, are left alone. The reshaped operands do not have shape information, so ``ShapeProp`` must be run again before ``optimize_einsums``.
+
+    Operands are flattened with ``flatten`` and the output is unflattened with sizes taken from the operands at runtime, so the graph still works for operands of the same ranks but different sizes. Which groups are merged, however, depends on the strides of the example operands; operands with other layouts are still handled correctly, but may be copied.
+
+    Args:
+        graph: the graph to process.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with merged einsum dimensions.
+    """
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    for node in list(graph.nodes):
+        if not _is_einsum(node):
+            continue
+        try:
+            inp_einstrs, out_einstr = _get_einstrs(node.args[0])
+        except NotImplementedError:
+            continue
+        operands = [
+            (get_shape(a), _known_stride(a)) if isinstance(a, fx.Node) else (None, None)
+            for a in node.args[1:]
+        ]
+        out_shape = get_shape(node)
+        if out_shape is None or any(
+            shape is None or stride is None for shape, stride in operands
+        ):
+            continue
+        sizes = {}
+        consistent = True
+        for (shape, _), es in zip(operands, inp_einstrs):
+            for lab, n in zip(es, shape):
+                consistent = consistent and sizes.setdefault(lab, n) == n
+        if not consistent:
+            # There's broadcasting going on, which we don't try to deal with
+            continue
+
+        groups = [
+            g
+            for group in _co_occurring_groups(inp_einstrs + [out_einstr])
+            for g in _split_for_views(group, operands, inp_einstrs)
+        ]
+        if len(groups) == 0:
+            continue
+
+        def merge(es: str) -> str:
+            for g in groups:
+                es = es.replace(g, g[0])
+            return es
+
+        old_args = node.args[1:]
+        new_args = []
+        with graph.inserting_before(node):
+            for arg, es in zip(old_args, inp_einstrs):
+                # Go backwards so that the positions of earlier groups don't change
+                for g in sorted(
+                    (g for g in groups if g in es), key=es.find, reverse=True
+                ):
+                    start = es.find(g)
+                    arg = graph.call_method("flatten", (arg, start, start + len(g) - 1))
+                new_args.append(arg)
+            new_out_einstr = merge(out_einstr)
+            if new_out_einstr != out_einstr:
+                # The sizes of the output's indices, from operands that have them
+                out_sizes = []
+                for lab in out_einstr:
+                    i = next(i for i, es in enumerate(inp_einstrs) if lab in es)
+                    out_sizes.append(
+                        graph.call_method("size", (old_args[i], inp_einstrs[i].find(lab)))
+                    )
+        node.args = (
+            ",".join(merge(es) for es in inp_einstrs) + "->" + new_out_einstr,
+        ) + tuple(new_args)
+        if new_out_einstr != out_einstr:
+            # Unmerge the output
+            with graph.inserting_after(node):
+                new_node = graph.call_method("reshape", tuple())  # placeholder
+                node.replace_all_uses_with(new_node)
+                new_node.args = (node, tuple(out_sizes))
+
+    graph.lint()
+    return graph
+
+
+_EXPAND_METHODS = {"expand", "expand_as"}
+
+
+def _is_unsqueezed(node, dim: int) -> bool:
+    """Whether dimension ``dim`` of ``node`` is inserted by an ``unsqueeze``, and so has size 1 whatever the graph's inputs."""
+    if not isinstance(node, fx.Node):
+        return False
+    if node.op == "call_method" and node.target == "unsqueeze":
+        args = node.args[1:]
+    elif node.op == "call_function" and node.target is torch.unsqueeze:
+        args = node.args[1:]
+    else:
+        return False
+    unsqueezed = args[0] if len(args) > 0 else node.kwargs.get("dim", None)
+    shape = get_shape(node)
+    if not isinstance(unsqueezed, int) or shape is None:
+        return False
+    return unsqueezed % len(shape) == dim
+
+
+def _broadcast_dims(node) -> List[int]:
+    """The dimensions of ``node`` that are broadcast whatever the graph's inputs: those that an ``expand`` adds in front of its input's, or expands from dimensions inserted by ``unsqueeze``.
+
+    Other dimensions of an ``expand`` are only broadcast if its input has size 1 there, which the example sizes don't show for other calls.
+    """
+    if not (
+        isinstance(node, fx.Node)
+        and node.op == "call_method"
+        and node.target in _EXPAND_METHODS
+    ):
+        return []
+    shape, in_shape = get_shape(node), get_shape(node.args[0]) if isinstance(node.args[0], fx.Node) else None
+    if shape is None or in_shape is None:
+        return []
+    leading = len(shape) - len(in_shape)
+    return [
+        d
+        for d in range(len(shape))
+        if d < leading or _is_unsqueezed(node.args[0], d - leading)
+    ]
+
+
+def _may_be_mutated(node: fx.Node) -> bool:
+    """Whether ``node``'s value may be changed in place, by the graph or by its caller."""
+    for user in node.users:
+        if user.op == "output":
+            return True
+        if user.op in ("call_method", "call_function"):
+            name = user.target if isinstance(user.target, str) else getattr(user.target, "__name__", "")
+            if name.endswith("_") and not name.endswith("__"):
+                return True
+    return False
+
+
+def squeeze_einsum_dims(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+    """Remove broadcast dimensions from einsum operands.
+
+    A dimension of an operand that has stride 0 because it was produced by an ``expand`` carries no information. Giving it to an einsum wastes FLOPs on broadcast data and can force it to be materialized. Such dimensions are removed from their operands with ``select``, which is always a view. Indices that no longer appear in any operand are restored in the output by ``unsqueeze`` and ``expand``, or, if they were summed over, by multiplying the result by their size. If the output may be changed in place --- because it is returned, or used by an in-place method --- the expanded output is copied, as ``torch.einsum``'s would have been fresh memory.
+
+    Only dimensions that the graph broadcasts itself, whatever its inputs, are removed: those that ``expand`` or ``expand_as`` add in front of their input's dimensions, or expand from dimensions inserted by ``unsqueeze``. The strides and sizes of inputs and attributes are only those of the examples, and another call could pass operands that aren't broadcast, or an ``expand`` input whose size-1 dimension is larger. All sizes are taken from the operands at runtime, so the graph still works for operands of the same ranks but different sizes.
+
+    This requires shape and stride information such as that populated by ``ShapeProp``; einsums without it are left alone. The new operands do not have shape information, so ``ShapeProp`` must be run again before ``optimize_einsums``.
+
+    Args:
+        graph: the graph to process.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with squeezed einsum operands.
+    """
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    for node in list(graph.nodes):
+        if not _is_einsum(node):
+            continue
+        try:
+            inp_einstrs, out_einstr = _get_einstrs(node.args[0])
+        except NotImplementedError:
+            continue
+        operands = [
+            (get_shape(a), get_stride(a)) if isinstance(a, fx.Node) else (None, None)
+            for a in node.args[1:]
+        ]
+        if get_shape(node) is None or any(
+            shape is None or stride is None for shape, stride in operands
+        ):
+            continue
+
+        new_inp_einstrs = []
+        to_remove = []
+        for arg, (shape, stride), es in zip(node.args[1:], operands, inp_einstrs):
+            remove = [
+                d
+                for d in _broadcast_dims(arg)
+                if es.count(es[d]) == 1 and shape[d] > 1
+            ]
+            new_inp_einstrs.append(
+                "".join(lab for d, lab in enumerate(es) if d not in remove)
+            )
+            to_remove.append(remove)
+        if all(len(remove) == 0 for remove in to_remove):
+            continue
+
+        remaining = set("".join(new_inp_einstrs))
+        new_out_einstr = "".join(lab for lab in out_einstr if lab in remaining)
+
+        old_args = node.args[1:]
+        new_args = []
+        # Where to get the size of each index that is removed everywhere
+        removed_sizes: Dict[str, fx.Node] = {}
+        with graph.inserting_before(node):
+            for arg, es, remove in zip(old_args, inp_einstrs, to_remove):
+                for d in remove:
+                    if es[d] not in remaining and es[d] not in removed_sizes:
+                        removed_sizes[es[d]] = graph.call_method("size", (arg, d))
+                # Go backwards so that the remaining dimensions' numbering doesn't change
+                for d in reversed(remove):
+                    arg = graph.call_method("select", (arg, d, 0))
+                new_args.append(arg)
+        node.args = (
+            ",".join(new_inp_einstrs) + "->" + new_out_einstr,
+        ) + tuple(new_args)
+
+        # Restore the output, if needed
+        chain = []
+        # Summing over an index that none of the remaining operands depend on is just multiplication by its size
+        for lab, size in removed_sizes.items():
+            if lab not in out_einstr:
+                chain.append((operator.mul, "call_function", (size,)))
+        if new_out_einstr != out_einstr:
+            for d, lab in enumerate(out_einstr):
+                if lab not in remaining:
+                    chain.append(("unsqueeze", "call_method", (d,)))
+            chain.append(
+                (
+                    "expand",
+                    "call_method",
+                    (
+                        tuple(
+                            removed_sizes[lab] if lab not in remaining else -1
+                            for lab in out_einstr
+                        ),
+                    ),
+                )
+            )
+            if _may_be_mutated(node):
+                # The expanded output can't be written to, unlike the einsum's
+                chain.append(("contiguous", "call_method", ()))
+        out_node = node
+        new_nodes = []
+        for target, op, extra_args in chain:
+            with graph.inserting_after(out_node):
+                out_node = graph.create_node(op, target, (out_node,) + extra_args)
+            new_nodes.append(out_node)
+        if len(new_nodes) > 0:
+            node.replace_all_uses_with(out_node)
+            # ... which also replaced the use of node that starts the chain
+            new_nodes[0].args = (node,) + tuple(new_nodes[0].args[1:])
+
+    graph.lint()
+    return graph
@@ -0,0 +1,67 @@
+from typing import Callable, List, Optional, Sequence, Union
+
+import torch
+from torch import fx
+
+from ._opt_ein import optimize_einsums_full
+
+
+def _concrete_inputs(example_inputs: Sequence) -> Optional[tuple]:
+    """Get tensors of zeros with the shapes, strides, dtypes, and ``requires_grad`` of ``example_inputs``, which may be fake, or ``None`` if any of their shapes are symbolic."""
+    out = []
+    for x in example_inputs:
+        if not isinstance(x, torch.Tensor):
+            if not isinstance(x, (int, float, bool)):
+                # A symbolic size
+                return None
+            out.append(x)
+            continue
+        if not all(isinstance(n, int) for n in tuple(x.shape) + tuple(x.stride())):
+            return None
+        # Fake tensors can't be run through ShapeProp, and real ones shouldn't be, since the graph may change them in place; the values don't matter, but zeros are valid indices
+        out.append(
+            torch.empty_strided(x.shape, x.stride(), dtype=x.dtype, device=x.device)
+            .zero_()
+            .requires_grad_(x.requires_grad)
+        )
+    return tuple(out)
+
+
+def opt_einsum_backend(
+    gm: fx.GraphModule,
+    example_inputs: List[torch.Tensor],
+    contract_kwargs: dict = {},
+    layout_aware: bool = False,
+    compile_with: Optional[Union[str, Callable]] = None,
+) -> Callable:
+    """A ``torch.compile`` backend that applies ``optimize_einsums_full`` to the graphs captured by TorchDynamo.
+
+    Example:
+        .. code-block:: python
+
+            model = torch.compile(model, backend=opt_einsum_fx.opt_einsum_backend, dynamic=False)
+
+    The package also registers this backend with TorchDynamo under the name ``"opt_einsum_fx"``, so installed copies can use ``backend="opt_einsum_fx"``. Other options are passed with ``functools.partial``.
+
+    Contraction paths are specific to shapes, so this should be used with ``dynamic=False``: TorchDynamo then recompiles for every new input shape, finding fresh paths each time. Graphs captured with symbolic shapes are returned unoptimized. Example inputs, real or fake, are replaced with tensors of zeros of the same shapes and strides, so the graph can be run to propagate shapes without touching the real inputs.
+
+    Args:
+        gm: the graph captured by TorchDynamo.
+        example_inputs: its inputs.
+        contract_kwargs: passed to ``optimize_einsums_full``.
+        layout_aware (bool, optional): passed to ``optimize_einsums_full``.
+        compile_with (str or callable, optional): another backend, such as ``"inductor"``, to pass the optimized graph on to.
+
+    Returns:
+        The optimized graph module, or what ``compile_with`` returns for it.
+    """
+    inputs = _concrete_inputs(example_inputs)
+    if inputs is not None:
+        gm = optimize_einsums_full(
+            gm, inputs, contract_kwargs=contract_kwargs, layout_aware=layout_aware
+        )
+    if compile_with is None:
+        return gm
+    from torch._dynamo.backends.registry import lookup_backend
+
+    return lookup_backend(compile_with)(gm, example_inputs)
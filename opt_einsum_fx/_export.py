@@ -0,0 +1,363 @@
+from typing import Any, Dict, List
+import json
+import math
+import operator
+import os
+
+import torch
+from torch import fx
+
+from ._message import _gather_einsum_scatter
+from ._sparse import _fetch_attr
+from ._symmetric import _symmetric_mm
+from .fx_utils import get_shape
+
+_INFIX_OPS = {
+    operator.add: "+",
+    operator.sub: "-",
+    operator.mul: "*",
+    operator.truediv: "/",
+}
+
+# Methods that take a shape or dimensions either as one tuple or as separate arguments, while their C++ versions only take an array
+_SHAPE_METHODS = {"permute", "reshape", "view", "expand", "repeat", "new_zeros", "new_empty", "new_ones"}
+
+# The parameters, and the C++ defaults of the optional ones, of the functions and methods whose keyword arguments are translated to positional ones
+_SIGNATURES = {
+    "diagonal": [("offset", "0"), ("dim1", "0"), ("dim2", "1")],
+    "sum": [("dim", None), ("keepdim", "false")],
+    "cat": [("tensors", None), ("dim", "0")],
+    "linalg_vecdot": [("x", None), ("y", None), ("dim", "-1")],
+}
+
+_SYMMETRIC_MM_SOURCE = """\
+torch::Tensor symmetric_mm(const torch::Tensor& x, int64_t blocks) {
+  const int64_t n = x.size(-2);
+  const int64_t block = (n + blocks - 1) / blocks;
+  std::vector<int64_t> shape(x.sizes().begin(), x.sizes().end() - 2);
+  shape.push_back(n);
+  shape.push_back(n);
+  torch::Tensor out = x.new_empty(shape);
+  for (int64_t i = 0; i < n; i += block) {
+    const int64_t rows = std::min(block, n - i);
+    torch::Tensor upper = torch::matmul(x.narrow(-2, i, rows), x.narrow(-2, i, n - i).transpose(-1, -2));
+    out.narrow(-2, i, rows).narrow(-1, i, n - i).copy_(upper);
+    out.narrow(-2, i, n - i).narrow(-1, i, rows).copy_(upper.transpose(-1, -2));
+  }
+  return out;
+}
+"""
+
+_GATHER_EINSUM_SCATTER_SOURCE = """\
+torch::Tensor gather_einsum_scatter(
+    torch::Tensor out, int64_t out_dim, const torch::Tensor& dst, const std::vector<torch::Tensor>& operands,
+    const std::vector<int64_t>& dims, const std::vector<int64_t>& gathers, const std::vector<torch::Tensor>& indices,
+    const std::vector<std::vector<int64_t>>& step_inputs, const std::vector<std::string>& step_equations,
+    int64_t n_hoisted, int64_t chunk_size) {
+  auto step = [&](const std::vector<torch::Tensor>& values, int64_t k) {
+    std::vector<torch::Tensor> inputs;
+    for (int64_t i : step_inputs[k]) {
+      inputs.push_back(values[i]);
+    }
+    return torch::einsum(step_equations[k], inputs);
+  };
+  std::vector<torch::Tensor> values(operands.begin(), operands.end());
+  for (int64_t k = 0; k < n_hoisted; ++k) {
+    values.push_back(step(values, k));
+  }
+  const int64_t n_edges = dst.size(0);
+  for (int64_t start = 0; start < n_edges; start += chunk_size) {
+    const int64_t length = std::min(chunk_size, n_edges - start);
+    std::vector<torch::Tensor> chunk(values.begin(), values.end());
+    for (size_t i = 0; i < operands.size(); ++i) {
+      if (gathers[i] >= 0) {
+        chunk[i] = operands[i].index_select(dims[i], indices[gathers[i]].narrow(0, start, length));
+      } else if (dims[i] >= 0) {
+        chunk[i] = operands[i].narrow(dims[i], start, length);
+      }
+    }
+    for (int64_t k = n_hoisted; k < static_cast<int64_t>(step_equations.size()); ++k) {
+      chunk.push_back(step(chunk, k));
+    }
+    out.index_add_(out_dim, dst.narrow(0, start, length), chunk.back());
+  }
+  return out;
+}
+"""
+
+# Functions of this library that graphs can call, with their C++ names and definitions
+_HELPERS = {
+    _symmetric_mm: ("symmetric_mm", _SYMMETRIC_MM_SOURCE),
+    _gather_einsum_scatter: ("gather_einsum_scatter", _GATHER_EINSUM_SCATTER_SOURCE),
+}
+
+# Functions whose C++ versions have different names
+_RENAMED = {
+    torch.sparse.mm: "torch::mm",
+}
+if hasattr(torch, "linalg") and hasattr(torch.linalg, "vecdot"):
+    _RENAMED[torch.linalg.vecdot] = "torch::linalg_vecdot"
+
+
+def _var(node: fx.Node) -> str:
+    return "v_" + node.name
+
+
+def _literal(value: Any) -> str:
+    """Write a constant or node argument as a C++ expression."""
+    if isinstance(value, fx.Node):
+        return _var(value)
+    if isinstance(value, bool):
+        return "true" if value else "false"
+    if isinstance(value, int):
+        return str(value)
+    if isinstance(value, float):
+        if math.isnan(value):
+            return "std::numeric_limits<double>::quiet_NaN()"
+        if math.isinf(value):
+            return ("" if value > 0 else "-") + "std::numeric_limits<double>::infinity()"
+        return repr(value)
+    if isinstance(value, str):
+        return json.dumps(value)
+    if value is None:
+        return "c10::nullopt"
+    if isinstance(value, torch.dtype):
+        return "torch::k" + {
+            torch.float16: "Float16",
+            torch.float32: "Float32",
+            torch.float64: "Float64",
+            torch.complex64: "ComplexFloat",
+            torch.complex128: "ComplexDouble",
+            torch.int32: "Int32",
+            torch.int64: "Int64",
+            torch.bool: "Bool",
+        }[value]
+    if isinstance(value, (tuple, list)):
+        return "{" + ", ".join(_literal(v) for v in value) + "}"
+    raise NotImplementedError(f"Can't write {value!r} in C++")
+
+
+def _positional(name: str, args: List[Any], kwargs: Dict[str, Any], offset: int = 0) -> List[Any]:
+    """Turn the keyword arguments of a call into positional ones, for a function or method with the signature ``_SIGNATURES[name]`` whose first ``offset`` arguments aren't in the signature."""
+    if len(kwargs) == 0:
+        return list(args)
+    if name not in _SIGNATURES:
+        raise NotImplementedError(f"Can't pass keyword arguments to {name} in C++")
+    params = _SIGNATURES[name]
+    out = list(args)
+    for param, default in params[len(args) - offset:]:
+        if param in kwargs:
+            out.append(kwargs[param])
+        elif default is not None:
+            out.append(_Raw(default))
+        else:
+            raise NotImplementedError(f"Missing argument {param} to {name}")
+    # Drop the defaults after the last argument that was given
+    while len(out) > len(args) and isinstance(out[-1], _Raw):
+        out.pop()
+    unknown = set(kwargs) - set(p for p, _ in params)
+    if len(unknown) > 0:
+        raise NotImplementedError(f"Can't pass {unknown} to {name} in C++")
+    return out
+
+
+class _Raw(str):
+    """C++ source to be used as it is."""
+
+
+def _args(values: List[Any]) -> str:
+    return ", ".join(v if isinstance(v, _Raw) else _literal(v) for v in values)
+
+
+def _expression(node: fx.Node, constants: Dict[str, int], helpers: Dict[str, str]) -> str:
+    """Write the value of a node as a C++ expression."""
+    args, kwargs = list(node.args), dict(node.kwargs)
+    if node.op == "get_attr":
+        return f"constants_[{constants[node.target]}]"
+    if node.op == "call_method":
+        self_arg, args = args[0], args[1:]
+        if node.target in _SHAPE_METHODS and len(args) > 0 and not isinstance(args[0], (tuple, list)):
+            args = [tuple(args)]
+        elif node.target in ("sum", "mean") and len(args) > 0 and isinstance(args[0], int):
+            args = [(args[0],)] + args[1:]
+        elif node.target == "size" and len(args) == 0:
+            return f"{_var(self_arg)}.sizes()"
+        return f"{_var(self_arg)}.{node.target}({_args(_positional(node.target, args, kwargs))})"
+    if node.op != "call_function":
+        raise NotImplementedError(f"Can't export {node.op} nodes to C++")
+    target = node.target
+    if target in _INFIX_OPS and len(kwargs) == 0:
+        a, b = args
+        return f"({_literal(a)} {_INFIX_OPS[target]} {_literal(b)})"
+    if target is operator.matmul:
+        return f"torch::matmul({_args(args)})"
+    if target is operator.neg:
+        return f"(-{_literal(args[0])})"
+    if target is getattr:
+        if args[1] == "shape":
+            return f"{_var(args[0])}.sizes()"
+        raise NotImplementedError(f"Can't export attribute {args[1]} to C++")
+    if target is operator.getitem:
+        x, idx = args
+        if isinstance(x, fx.Node) and get_shape(x) is None and isinstance(idx, int):
+            # Sizes, or a tuple of results
+            return f"{_var(x)}[{idx}]"
+        if isinstance(idx, fx.Node):
+            return f"{_var(x)}.index({{{_var(idx)}}})"
+        if isinstance(idx, int):
+            return f"{_var(x)}.select(0, {idx})"
+        raise NotImplementedError(f"Can't export indexing by {idx!r} to C++")
+    if target in _HELPERS:
+        name, source = _HELPERS[target]
+        helpers[name] = source
+        return f"{name}({_args(_positional(name, args, kwargs))})"
+    if target in (torch.einsum, torch.functional.einsum):
+        operands = args[1] if len(args) == 2 and isinstance(args[1], (tuple, list)) else args[1:]
+        return f"torch::einsum({_literal(args[0])}, {_literal(list(operands))})"
+    if target in (torch.tensordot, torch.functional.tensordot):
+        a, b = args[:2]
+        dims = args[2] if len(args) > 2 else kwargs.get("dims", 2)
+        if isinstance(dims, int):
+            dims = (list(range(-dims, 0)), list(range(dims)))
+        return f"torch::tensordot({_args([a, b, list(dims[0]), list(dims[1])])})"
+    if target in _RENAMED:
+        name = _RENAMED[target]
+        return f"{name}({_args(_positional(name[len('torch::'):], args, kwargs))})"
+    name = getattr(target, "__name__", None)
+    if name is not None and getattr(torch, name, None) is target:
+        return f"torch::{name}({_args(_positional(name, args, kwargs, offset=1 if name != 'cat' else 0))})"
+    raise NotImplementedError(f"Can't export {repr(node)} to C++")
+
+
+def export_cpp(module: fx.GraphModule, directory: str, name: str = "OptimizedModel") -> None:
+    """Write an ``fx.GraphModule``, such as one from ``optimize_einsums_full``, as a standalone LibTorch C++ class.
+
+    The graph is translated node by node into direct calls to the ATen operations it uses, so the contraction paths, index orders, and static shapes chosen during optimization are kept and no Python or TorchScript interpreter is needed to run it. ``directory`` gets four files:
+
+        - ``<name>.h`` and ``<name>.cpp``, defining a class ``<name>`` with a constructor that takes the path of the constants file and a ``forward`` method with the graph's inputs, computed without gradients
+        - ``<name>_constants.pt``, the parameters and buffers the graph uses, to be loaded by the constructor
+        - ``CMakeLists.txt``, defining a library target ``<name>`` that links to LibTorch, for use with ``add_subdirectory``
+
+    Only tensor inputs, and a tensor or tuple of tensors as output, are supported. Operations without a known C++ translation raise ``NotImplementedError``; this includes einsums compiled with ``compile_einsums``.
+
+    Args:
+        module: the graph module to export.
+        directory: where to write the files; created if it doesn't exist.
+        name (str, optional): the name of the class, library target, and files.
+    """
+    if not name.isidentifier():
+        raise ValueError(f"{name!r} is not a valid C++ class name")
+    graph = module.graph
+
+    inputs: List[str] = []
+    constants: Dict[str, int] = {}
+    helpers: Dict[str, str] = {}
+    body: List[str] = []
+    returns_tuple = False
+    for node in graph.nodes:
+        if node.op == "placeholder":
+            if len(node.args) > 0:
+                raise NotImplementedError("Inputs with default values can't be exported to C++")
+            inputs.append(f"const torch::Tensor& {_var(node)}")
+        elif node.op == "output":
+            out = node.args[0]
+            if isinstance(out, (tuple, list)):
+                returns_tuple = True
+                body.append(f"  return {_literal(list(out))};")
+            else:
+                body.append(f"  return {_literal(out)};")
+        else:
+            if node.op == "get_attr" and node.target not in constants:
+                constants[node.target] = len(constants)
+            body.append(f"  auto {_var(node)} = {_expression(node, constants, helpers)};")
+
+    os.makedirs(directory, exist_ok=True)
+
+    # Sparse tensors are saved as their indices and values, which pickle_load can read
+    saved = {}
+    loads = []
+    for target in constants:
+        value = _fetch_attr(module, target)
+        if not isinstance(value, torch.Tensor):
+            raise NotImplementedError(f"Constant {target} isn't a tensor")
+        value = value.detach()
+        if value.layout == torch.sparse_coo:
+            value = value.coalesce()
+            saved[target + ".indices"] = value.indices()
+            saved[target + ".values"] = value.values()
+            loads.append(
+                f"  constants_.push_back(torch::sparse_coo_tensor(constants.at({json.dumps(target + '.indices')}).toTensor(), "
+                f"constants.at({json.dumps(target + '.values')}).toTensor(), {_literal(list(value.shape))}).coalesce());"
+            )
+        else:
+            saved[target] = value
+            loads.append(f"  constants_.push_back(constants.at({json.dumps(target)}).toTensor());")
+    torch.save(saved, os.path.join(directory, f"{name}_constants.pt"))
+
+    return_type = "std::vector<torch::Tensor>" if returns_tuple else "torch::Tensor"
+    signature = f"forward({', '.join(inputs)}) const"
+    header = f"""\
+// Generated by opt_einsum_fx.export_cpp
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+class {name} {{
+ public:
+  explicit {name}(const std::string& constants_path);
+
+  {return_type} {signature};
+
+ private:
+  std::vector<torch::Tensor> constants_;
+}};
+"""
+    helper_source = ""
+    if len(helpers) > 0:
+        helper_source = "namespace {\n" + "".join("\n" + h for h in helpers.values()) + "\n}  // namespace\n\n"
+    source = f"""\
+// Generated by opt_einsum_fx.export_cpp
+#include "{name}.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+#include <torch/script.h>
+
+{helper_source}{name}::{name}(const std::string& constants_path) {{
+  std::ifstream file(constants_path, std::ios::binary);
+  TORCH_CHECK(file, "could not open ", constants_path);
+  std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  c10::Dict<c10::IValue, c10::IValue> constants = torch::pickle_load(data).toGenericDict();
+{chr(10).join(loads)}
+}}
+
+{return_type} {name}::{signature} {{
+  torch::NoGradGuard no_grad;
+{chr(10).join(body)}
+}}
+"""
+    cmake = f"""\
+# Generated by opt_einsum_fx.export_cpp
+cmake_minimum_required(VERSION 3.18)
+project({name} LANGUAGES CXX)
+
+find_package(Torch REQUIRED)
+
+add_library({name} {name}.cpp)
+target_include_directories({name} PUBLIC ${{CMAKE_CURRENT_SOURCE_DIR}})
+target_link_libraries({name} PUBLIC ${{TORCH_LIBRARIES}})
+target_compile_features({name} PUBLIC cxx_std_17)
+"""
+    for filename, text in (
+        (f"{name}.h", header),
+        (f"{name}.cpp", source),
+        ("CMakeLists.txt", cmake),
+    ):
+        with open(os.path.join(directory, filename), "w") as f:
+            f.write(text)
@@ -0,0 +1,183 @@
+from typing import Dict, List, Optional, Sequence, Tuple
+import copy
+import operator
+
+import torch
+from torch import fx
+
+from ._fuse import _get_einstrs, _is_einsum
+
+_ADD_FUNCS = {operator.add, torch.add}
+_SUB_FUNCS = {operator.sub, torch.sub}
+
+
+def _get_sum_terms(node: fx.Node) -> Optional[Tuple[fx.Node, fx.Node, bool]]:
+    """Get the two terms of a sum or difference, and whether it is a difference."""
+    if len(node.args) != 2 or len(node.kwargs) > 0:
+        # Excludes things like `alpha=`
+        return None
+    if node.op == "call_function":
+        if node.target in _ADD_FUNCS:
+            return node.args[0], node.args[1], False
+        elif node.target in _SUB_FUNCS:
+            return node.args[0], node.args[1], True
+    elif node.op == "call_method":
+        # TODO: this could _technically_ be wrong if the nodes `self` argument is not a (proxy to) a Tensor
+        if node.target == "add":
+            return node.args[0], node.args[1], False
+        elif node.target == "sub":
+            return node.args[0], node.args[1], True
+    return None
+
+
+def _extend_label_map(
+    label_map: Dict[str, str], from_labels: str, to_labels: str
+) -> Optional[Dict[str, str]]:
+    """Extend a bijection between labels so that it maps ``from_labels`` onto ``to_labels``, if possible."""
+    if len(from_labels) != len(to_labels):
+        return None
+    new_map = dict(label_map)
+    for f, t in zip(from_labels, to_labels):
+        if new_map.setdefault(f, t) != t:
+            return None
+    if len(set(new_map.values())) != len(new_map):
+        # Not one-to-one
+        return None
+    return new_map
+
+
+def _match_operands(
+    ours: List[Tuple[fx.Node, str]],
+    theirs: List[Tuple[fx.Node, str]],
+    label_map: Dict[str, str],
+) -> Optional[Dict[str, str]]:
+    """Pair up identical operands of two einsums so that they play the same roles in both."""
+    if len(theirs) == 0:
+        return label_map
+    (their_op, their_labels), rest = theirs[0], theirs[1:]
+    for i, (our_op, our_labels) in enumerate(ours):
+        if our_op is not their_op:
+            continue
+        new_map = _extend_label_map(label_map, their_labels, our_labels)
+        if new_map is None:
+            continue
+        new_map = _match_operands(ours[:i] + ours[i + 1:], rest, new_map)
+        if new_map is not None:
+            return new_map
+    return None
+
+
+def _find_common_factor(a: fx.Node, b: fx.Node) -> Optional[Tuple[int, int]]:
+    """Find the operands in which einsums ``a`` and ``b`` differ, if they are otherwise the same up to relabeling.
+
+    Returns:
+        The index of the differing operand in ``a``'s and in ``b``'s operands, or ``None``.
+    """
+    try:
+        a_inp_einstrs, a_out_einstr = _get_einstrs(a.args[0])
+        b_inp_einstrs, b_out_einstr = _get_einstrs(b.args[0])
+    except NotImplementedError:
+        return None
+    a_ops: Sequence = a.args[1:]
+    b_ops: Sequence = b.args[1:]
+    if len(a_ops) != len(b_ops):
+        return None
+    out_map = _extend_label_map({}, b_out_einstr, a_out_einstr)
+    if out_map is None:
+        return None
+    for a_diff in range(len(a_ops)):
+        for b_diff in range(len(b_ops)):
+            label_map = _extend_label_map(
+                out_map, b_inp_einstrs[b_diff], a_inp_einstrs[a_diff]
+            )
+            if label_map is None:
+                continue
+            label_map = _match_operands(
+                [
+                    (op, es)
+                    for i, (op, es) in enumerate(zip(a_ops, a_inp_einstrs))
+                    if i != a_diff
+                ],
+                [
+                    (op, es)
+                    for i, (op, es) in enumerate(zip(b_ops, b_inp_einstrs))
+                    if i != b_diff
+                ],
+                label_map,
+            )
+            if label_map is not None:
+                return a_diff, b_diff
+    return None
+
+
+def factor_einsums(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+    """Use the distributivity of einsum to factor common operands out of sums of einsums.
+
+    When two einsums are the same --- up to relabeling and reordering of their operands --- except in one operand, their sum or difference can be computed with a single einsum over the sum or difference of the differing operands.
+
+    Example:
+        .. code-block:: python
+
+            def factorable(A, x, y):
+                return torch.einsum("ij,j->i", A, x) + torch.einsum("ab,b->a", A, y)
+
+            g = torch.fx.symbolic_trace(factorable)
+            print(factor_einsums(g.graph).python_code(""))
+
+        gives::
+
+            import torch
+            def forward(self, A, x, y):
+                add_1 = x + y;  x = y = None
+                einsum_2 = torch.functional.einsum('ij,j->i', A, add_1);  A = add_1 = None
+                return einsum_2
+
+    Only einsums whose output is used by nothing but the sum are factored. Sums of more than two terms are factored one pair at a time.
+
+    Args:
+        graph: the graph to process.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with factored einsums.
+    """
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    # Factoring one sum can create an einsum that is a term in another, so repeat until nothing changes
+    changed = True
+    while changed:
+        changed = False
+        for node in list(graph.nodes):
+            terms = _get_sum_terms(node)
+            if terms is None:
+                continue
+            a, b, is_sub = terms
+            if not (
+                _is_einsum(a)
+                and _is_einsum(b)
+                and a is not b
+                and len(a.users) == 1
+                and len(b.users) == 1
+            ):
+                continue
+            diff = _find_common_factor(a, b)
+            if diff is None:
+                continue
+            a_diff, b_diff = diff
+            with graph.inserting_before(node):
+                summed = graph.call_function(
+                    operator.sub if is_sub else operator.add,
+                    (a.args[1 + a_diff], b.args[1 + b_diff]),
+                )
+                new_args = list(a.args)
+                new_args[1 + a_diff] = summed
+                new_node = graph.call_function(a.target, tuple(new_args))
+            node.replace_all_uses_with(new_node)
+            graph.erase_node(node)
+            graph.erase_node(a)
+            graph.erase_node(b)
+            changed = True
+
+    graph.lint()
+    return graph
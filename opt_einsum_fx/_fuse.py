@@ -1,4 +1,4 @@
-from typing import List, Optional, Tuple
+from typing import Dict, List, Optional, Set, Tuple
 import string
 import copy
 import operator
@@ -10,6 +10,7 @@ from torch import fx
 from opt_einsum.parser import find_output_str
 
 from .fx_utils import get_shape
+from ._cost import _einsum_args_cost
 
 _EINSUM_FUNCS = {torch.functional.einsum, torch.einsum}
 
@@ -31,7 +32,135 @@ def _get_einstrs(einstr: str) -> Tuple[List[str], str]:
     return ops.split(","), out
 
 
-def fuse_einsums(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+def _fuse_operands(
+    node: fx.Node, to_fuse: Set[int]
+) -> Tuple[str, tuple, List[fx.Node]]:
+    """Compute the arguments of einsum ``node`` with the einsums producing the operands at ``to_fuse`` fused into it.
+
+    ``node`` itself is not modified.
+
+    Returns:
+        The new einstr, the new operands, and the fused producer einsums.
+    """
+    our_inp_einstrs, our_out_einstr = _get_einstrs(node.args[0])
+    assert len(our_inp_einstrs) == len(node.args) - 1
+    avail_letters = iter(
+        set(string.ascii_lowercase) - set.union(*(set(e) for e in our_inp_einstrs))
+    )
+    new_our_einstrs = []
+    new_our_args = []
+    we_fused_nodes = []
+    # Iterate over operands
+    for inp_idex, inp in enumerate(node.args[1:]):
+        if inp_idex in to_fuse:
+            # This operand is the output of another einsum that we've decided to fuse
+            its_inp_einstrs, its_out_einstr = _get_einstrs(inp.args[0])
+            if len(its_out_einstr) != len(our_inp_einstrs[inp_idex]):
+                raise RuntimeError(
+                    f"Inconsistent rank: einsum `{node}`'s input {inp_idex} is the result of einsum {inp}; the output of `{inp}` is labeled `{its_out_einstr}` (rank {len(its_out_einstr)}), but the corresponding input of `{node}` is labeled `{our_inp_einstrs[inp_idex]}` (rank {len(our_inp_einstrs[inp_idex])})"
+                )
+            # First, we need to figure out which of its output dimensions correspond to our dimensions:
+            its_dim_to_ours = dict(zip(its_out_einstr, our_inp_einstrs[inp_idex]))
+            # assign any labels that don't show up in the output of the previous einsum --- and thus dont have labels in the current einsum --- to new letters
+            its_remaining_labels = set.union(*(set(e) for e in its_inp_einstrs)) - set(
+                its_dim_to_ours.keys()
+            )
+            try:
+                its_dim_to_ours.update(
+                    dict((i, next(avail_letters)) for i in its_remaining_labels)
+                )
+            except StopIteration:
+                # We ran out of letters
+                raise NotImplementedError(
+                    f"At einsum {node}, ran out of letters when trying to fuse parameter einsum {inp}. A fallback for this case is not yet implimented."
+                )
+            else:
+                # We had enough letters, finish adding the fuse
+                del its_remaining_labels
+                new_our_args.extend(inp.args[1:])
+                new_our_einstrs.extend(
+                    "".join(its_dim_to_ours[d] for d in es) for es in its_inp_einstrs
+                )
+                if inp not in we_fused_nodes:
+                    we_fused_nodes.append(inp)
+        else:
+            # This argument is not from an einsum, or is from an einsum that we aren't fusing
+            # Thus we just pass it through
+            new_our_einstrs.append(our_inp_einstrs[inp_idex])
+            new_our_args.append(inp)
+    # -- end iter over prev einsum inputs --
+    return (
+        f"{','.join(new_our_einstrs)}->{our_out_einstr}",
+        tuple(new_our_args),
+        we_fused_nodes,
+    )
+
+
+def _is_einsum(node) -> bool:
+    return (
+        isinstance(node, fx.Node)
+        and node.op == "call_function"
+        and node.target in _EINSUM_FUNCS
+    )
+
+
+def _should_duplicate(producer: fx.Node, contract_kwargs: dict) -> bool:
+    """Decide whether recomputing ``producer`` inside each of its einsum users is cheaper than materializing it."""
+    users = list(producer.users.keys())
+    if not all(_is_einsum(u) for u in users):
+        # Someone besides an einsum needs the materialized result anyway
+        return False
+    materialize_cost = _einsum_args_cost(
+        producer.args[0], producer.args[1:], contract_kwargs
+    )
+    duplicate_cost = 0
+    for user in users:
+        user_cost = _einsum_args_cost(user.args[0], user.args[1:], contract_kwargs)
+        try:
+            fused_einstr, fused_args, _ = _fuse_operands(
+                user,
+                set(i for i, a in enumerate(user.args[1:]) if a is producer),
+            )
+        except NotImplementedError:
+            # Not enough letters to fuse
+            return False
+        fused_cost = _einsum_args_cost(fused_einstr, fused_args, contract_kwargs)
+        if materialize_cost is None or user_cost is None or fused_cost is None:
+            return False
+        materialize_cost += user_cost
+        duplicate_cost += fused_cost
+    return duplicate_cost < materialize_cost
+
+
+def _should_fuse(
+    node: fx.Node, to_fuse: Set[int], inp_idex: int, contract_kwargs: dict
+) -> bool:
+    """Decide whether fusing the einsum producing operand ``inp_idex`` into ``node``, on top of ``to_fuse``, is no more expensive than computing them separately."""
+    producer = node.args[1 + inp_idex]
+    try:
+        fused_einstr, fused_args, _ = _fuse_operands(node, to_fuse | {inp_idex})
+    except NotImplementedError:
+        # Not enough letters to fuse
+        return False
+    our_einstr, our_args, _ = _fuse_operands(node, to_fuse)
+    costs = [
+        _einsum_args_cost(producer.args[0], producer.args[1:], contract_kwargs),
+        _einsum_args_cost(our_einstr, our_args, contract_kwargs),
+        _einsum_args_cost(fused_einstr, fused_args, contract_kwargs),
+    ]
+    if any(c is None for c in costs):
+        # Without shapes we can't tell, so default to fusing
+        return True
+    producer_cost, our_cost, fused_cost = costs
+    return fused_cost <= producer_cost + our_cost
+
+
+def fuse_einsums(
+    graph: fx.Graph,
+    in_place: bool = False,
+    cost_aware: bool = False,
+    contract_kwargs: dict = {},
+) -> fx.Graph:
     """Fuse einsums when possible.
 
     When the output of one einsum is only used as an operand in another einsum, the two einsums can be fused into one.
@@ -53,9 +182,13 @@ def fuse_einsums(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
                 einsum_2 = torch.functional.einsum('ib,bk,ij->i', x, y, x);  x = y = None
                 return einsum_2
 
+    If ``cost_aware`` is true, every fusion is checked against the ``opt_einsum`` cost of the optimal contraction of the fused einsum, and only made if that is no more than the total cost of the separate einsums. Einsums whose outputs are used by several other einsums are also considered: if recomputing such an einsum inside each of its users is cheaper than computing it once and materializing its output, it is fused into all of them. This requires shape information such as that populated by ``ShapeProp``; without it, einsums are fused only as they would be if ``cost_aware`` were false.
+
     Args:
         graph: the graph to process.
         in_place (bool, optional): whether to process ``graph`` in place.
+        cost_aware (bool, optional): whether to use ``opt_einsum`` costs to decide on fusions that aren't always beneficial.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path`` when computing costs.
 
     Returns:
         The graph with fused einsums.
@@ -63,70 +196,40 @@ def fuse_einsums(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
     if not in_place:
         graph = copy.deepcopy(graph)
 
+    # Cache of decisions about einsums with multiple users
+    duplicate: Dict[fx.Node, bool] = {}
+
     for node in graph.nodes:
-        if node.op == "call_function" and node.target in _EINSUM_FUNCS:
-            our_inp_einstrs, our_out_einstr = _get_einstrs(node.args[0])
-            assert len(our_inp_einstrs) == len(node.args) - 1
-            avail_letters = iter(
-                set(string.ascii_lowercase)
-                - set.union(*(set(e) for e in our_inp_einstrs))
-            )
-            new_our_einstrs = []
-            new_our_args = []
-            we_fused_nodes = []
-            # Iterate over operands
+        if _is_einsum(node):
+            to_fuse = set()
             for inp_idex, inp in enumerate(node.args[1:]):
-                if (
-                    inp.op == "call_function"
-                    and inp.target in _EINSUM_FUNCS
-                    and len(inp.users) == 1
-                ):
+                if not _is_einsum(inp):
+                    continue
+                if inp in duplicate:
+                    # We've already made a decision about this one
+                    fuse = duplicate[inp]
+                elif len(inp.users) == 1:
                     # This operand is the output of another einsum, and is not used by any other operation
-                    # As a result, we can fuse it
-                    its_inp_einstrs, its_out_einstr = _get_einstrs(inp.args[0])
-                    if len(its_out_einstr) != len(our_inp_einstrs[inp_idex]):
-                        raise RuntimeError(
-                            f"Inconsistent rank: einsum `{node}`'s input {inp_idex} is the result of einsum {inp}; the output of `{inp}` is labeled `{its_out_einstr}` (rank {len(its_out_einstr)}), but the corresponding input of `{node}` is labeled `{our_inp_einstrs[inp_idex]}` (rank {len(our_inp_einstrs[inp_idex])})"
-                        )
-                    # First, we need to figure out which of its output dimensions correspond to our dimensions:
-                    its_dim_to_ours = dict(
-                        zip(its_out_einstr, our_inp_einstrs[inp_idex])
+                    # As a result, we can fuse it, if it is worth it
+                    fuse = (not cost_aware) or _should_fuse(
+                        node, to_fuse, inp_idex, contract_kwargs
                     )
-                    # assign any labels that don't show up in the output of the previous einsum --- and thus dont have labels in the current einsum --- to new letters
-                    its_remaining_labels = set.union(
-                        *(set(e) for e in its_inp_einstrs)
-                    ) - set(its_dim_to_ours.keys())
-                    try:
-                        its_dim_to_ours.update(
-                            dict((i, next(avail_letters)) for i in its_remaining_labels)
-                        )
-                    except StopIteration:
-                        # We ran out of letters
-                        raise NotImplementedError(
-                            f"At einsum {node}, ran out of letters when trying to fuse parameter einsum {inp}. A fallback for this case is not yet implimented."
-                        )
-                    else:
-                        # We had enough letters, finish adding the fuse
-                        del its_remaining_labels
-                        new_our_args.extend(inp.args[1:])
-                        new_our_einstrs.extend(
-                            "".join(its_dim_to_ours[d] for d in es)
-                            for es in its_inp_einstrs
-                        )
-                        we_fused_nodes.append(inp)
+                elif cost_aware:
+                    duplicate[inp] = _should_duplicate(inp, contract_kwargs)
+                    fuse = duplicate[inp]
                 else:
-                    # This argument is not from an einsum, or is from an einsum that is used elsewhere as well
-                    # Thus we just pass it through
-                    new_our_einstrs.append(our_inp_einstrs[inp_idex])
-                    new_our_args.append(inp)
-            # -- end iter over prev einsum inputs --
+                    fuse = False
+                if fuse:
+                    to_fuse.add(inp_idex)
+            if len(to_fuse) == 0:
+                continue
+            new_einstr, new_args, we_fused_nodes = _fuse_operands(node, to_fuse)
             # Set the new values for the einstrs
-            node.args = (f"{','.join(new_our_einstrs)}->{our_out_einstr}",) + tuple(
-                new_our_args
-            )
-            # Remove fused inputs
+            node.args = (new_einstr,) + new_args
+            # Remove fused inputs that nobody else needs anymore
             for to_remove in we_fused_nodes:
-                graph.erase_node(to_remove)
+                if len(to_remove.users) == 0:
+                    graph.erase_node(to_remove)
         # -- end case for einsum nodes --
     # -- end iter over nodes --
     return graph
@@ -0,0 +1,22 @@
+from typing import Dict, Sequence, Tuple
+
+import opt_einsum
+
+
+class _Shaped:
+    def __init__(self, shape):
+        self.shape = shape
+
+
+def _canonical_einsum(einstr: str, shapes: Sequence[Sequence[int]]) -> Tuple[str, Tuple[Tuple[int, ...], ...]]:
+    """Get an einsum string equivalent to ``einstr`` with its indices renamed in order of first appearance, and the shapes, so that einsums that only differ in index names get the same key."""
+    shapes = tuple(tuple(int(n) for n in s) for s in shapes)
+    inputs, output, _ = opt_einsum.parser.parse_einsum_input(
+        (einstr,) + tuple(_Shaped(s) for s in shapes)
+    )
+    names: Dict[str, str] = {}
+    for lab in inputs.replace(",", "") + output:
+        if lab not in names:
+            names[lab] = opt_einsum.get_symbol(len(names))
+    canonical = "".join(names.get(lab, lab) for lab in inputs + "->" + output)
+    return canonical, shapes
@@ -0,0 +1,298 @@
+from typing import Dict, List, Optional, Sequence, Tuple
+import copy
+import itertools
+import string
+
+import torch
+from torch import fx
+
+from ._cost import einsum_cost
+from ._fuse import _get_einstrs, _is_einsum, prod
+from ._sparse import _fetch_attr
+from .fx_utils import get_shape
+
+_KRON_ATTR: str = "_opt_einsum_fx_kron"
+# Don't look for factors of constants bigger than this
+_KRON_MAX_NUMEL: int = 2 ** 20
+# Don't try more than this many ways of splitting a constant
+_KRON_MAX_SPLITS: int = 64
+
+
+def annotate_kronecker(
+    tensor: torch.Tensor, left: torch.Tensor, right: torch.Tensor
+) -> torch.Tensor:
+    """Declare that a constant is the Kronecker product ``torch.kron(left, right)``.
+
+    ``factor_kronecker_operands`` detects constants that are Kronecker products by itself, up to numerical tolerance; this skips the detection and makes sure the given factors are used. The factors are used in place of ``tensor`` from then on, so ``tensor`` must not change.
+
+    Args:
+        tensor: the product.
+        left: the first factor.
+        right: the second factor.
+
+    Returns:
+        ``tensor``.
+    """
+    if left.dim() != tensor.dim() or right.dim() != tensor.dim():
+        raise ValueError("The factors must have as many dimensions as the product")
+    if any(p * q != n for p, q, n in zip(left.shape, right.shape, tensor.shape)):
+        raise ValueError(
+            f"Factors of shapes {tuple(left.shape)} and {tuple(right.shape)} don't make a product of shape {tuple(tensor.shape)}"
+        )
+    setattr(tensor, _KRON_ATTR, (left, right))
+    return tensor
+
+
+def _kronecker_splits(shape: Sequence[int]) -> List[Tuple[Tuple[int, ...], Tuple[int, ...]]]:
+    """The ways of splitting ``shape`` into the shapes of two nontrivial Kronecker factors."""
+    per_dim = [[(p, n // p) for p in range(1, n + 1) if n % p == 0] for n in shape]
+    out = []
+    for split in itertools.product(*per_dim):
+        left = tuple(p for p, _ in split)
+        right = tuple(q for _, q in split)
+        if prod(left) == 1 or prod(right) == 1:
+            continue
+        out.append((left, right))
+        if len(out) >= _KRON_MAX_SPLITS:
+            break
+    return out
+
+
+def _kronecker_factors(
+    value: torch.Tensor,
+    left: Sequence[int],
+    right: Sequence[int],
+    rtol: Optional[float] = None,
+) -> Optional[Tuple[torch.Tensor, torch.Tensor]]:
+    """Factor ``value`` as ``torch.kron`` of tensors of shapes ``left`` and ``right``, if it is one up to a relative tolerance ``rtol``, by default a small multiple of the precision of ``value``.
+
+    The entries of a Kronecker product, rearranged into a matrix whose rows are indexed by the first factor's indices and whose columns are indexed by the second's, form a rank one matrix (Van Loan and Pitsianis); its singular vectors are the factors.
+    """
+    if rtol is None:
+        rtol = 100 * torch.finfo(value.dtype).eps
+    ndim = value.dim()
+    interleaved = [n for pq in zip(left, right) for n in pq]
+    mat = (
+        value.detach()
+        .to(torch.float64)
+        .reshape(interleaved)
+        .permute(list(range(0, 2 * ndim, 2)) + list(range(1, 2 * ndim, 2)))
+        .reshape(prod(left), prod(right))
+    )
+    u, s, vh = torch.linalg.svd(mat, full_matrices=False)
+    if s[0] == 0 or (len(s) > 1 and s[1] > rtol * s[0]):
+        return None
+    scale = s[0].sqrt()
+    return (
+        (u[:, 0] * scale).reshape(left).to(value.dtype),
+        (vh[0] * scale).reshape(right).to(value.dtype),
+    )
+
+
+def _get_kronecker_candidates(
+    node: fx.Node, owner: torch.nn.Module
+) -> List[Tuple[torch.Tensor, torch.Tensor]]:
+    """Get the ways a constant ``get_attr`` node of ``owner`` factors as a Kronecker product."""
+    if not isinstance(node, fx.Node) or node.op != "get_attr":
+        return []
+    value = _fetch_attr(owner, node.target)
+    if not isinstance(value, torch.Tensor):
+        return []
+    factors = getattr(value, _KRON_ATTR, None)
+    if factors is not None:
+        return [factors]
+    if (
+        isinstance(value, torch.nn.Parameter)
+        or value.requires_grad
+        or value.layout != torch.strided
+        or not value.is_floating_point()
+        or value.numel() > _KRON_MAX_NUMEL
+    ):
+        # Parameters can change, so aren't constant
+        return []
+    out = []
+    for left, right in _kronecker_splits(value.shape):
+        factors = _kronecker_factors(value, left, right)
+        if factors is not None:
+            out.append(factors)
+    return out
+
+
+def _split_labels(
+    es: str, shape: Sequence[int], splits: dict
+) -> Tuple[str, Optional[Tuple[int, ...]]]:
+    """Split the labels of an operand according to ``splits``, which maps labels to their two new labels and sizes, and get the shape it has to be reshaped to, if any."""
+    if not any(lab in splits for lab in es):
+        return es, None
+    new_es = ""
+    new_shape = []
+    for lab, n in zip(es, shape):
+        if lab in splits:
+            (lab_p, p), (lab_q, q) = splits[lab]
+            new_es += lab_p + lab_q
+            new_shape += [p, q]
+        else:
+            new_es += lab
+            new_shape.append(int(n))
+    return new_es, tuple(new_shape)
+
+
+def _split_shape(graph: fx.Graph, arg: fx.Node, es: str, splits: dict) -> tuple:
+    """The shape to reshape ``arg`` to to split its indices according to ``splits``: the factors' sizes for split indices, and ``arg``'s own sizes at runtime for the others."""
+    new_shape = []
+    for d, lab in enumerate(es):
+        if lab in splits:
+            (_, p), (_, q) = splits[lab]
+            new_shape += [p, q]
+        else:
+            new_shape.append(graph.call_method("size", (arg, d)))
+    return tuple(new_shape)
+
+
+def _factor_dims(left: torch.Tensor, right: torch.Tensor) -> Tuple[List[bool], List[bool]]:
+    """Which dimensions of each Kronecker factor to keep; dimensions of size 1 are dropped unless the product's dimension also has size 1."""
+    return (
+        [p > 1 or q == 1 for p, q in zip(left.shape, right.shape)],
+        [q > 1 for q in right.shape],
+    )
+
+
+def factor_kronecker_operands(
+    graph: fx.Graph, contract_kwargs: dict = {}, in_place: bool = False
+) -> fx.Graph:
+    """Replace constant einsum operands that are Kronecker products with their factors.
+
+    A constant like ``torch.kron(torch.eye(4), coefficients)`` is an einsum of its factors: its indices split into an index of each factor. Giving the factors to ``opt_einsum`` as separate operands lets it find paths that never materialize the product. The other operands and the output are reshaped to split the same indices; their other dimensions keep the sizes of the operands at runtime, so the graph still works for operands of the same ranks but different sizes.
+
+    Constants --- buffers of the graph's owning module that are accessed with ``get_attr`` --- are checked numerically for every way of splitting their dimensions; constants can also be declared Kronecker products with ``annotate_kronecker``. An operand is only replaced if that makes the ``opt_einsum`` cost of the einsum lower. The factors are registered as new buffers of the owning module, once for all the einsums that use the same constant.
+
+    This requires shape information such as that populated by ``ShapeProp``; einsums without it are left alone. The new nodes do not have shape information, so ``ShapeProp`` must be run again before ``optimize_einsums``.
+
+    Args:
+        graph: the graph to process.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with factored operands.
+    """
+    owner = getattr(graph, "owning_module", None)
+    if not in_place:
+        graph = copy.deepcopy(graph)
+    if owner is None:
+        return graph
+
+    # The candidates of each constant, which takes SVDs to find, by get_attr target
+    candidates: Dict[str, List[Tuple[torch.Tensor, torch.Tensor]]] = {}
+    # The names of the factor buffers registered for each constant, by get_attr target and the left factor's shape
+    registered: Dict[Tuple[str, Tuple[int, ...]], Tuple[str, str]] = {}
+    for node in list(graph.nodes):
+        if not _is_einsum(node) or "..." in node.args[0]:
+            continue
+        args = list(node.args[1:])
+        shapes = [get_shape(a) if isinstance(a, fx.Node) else None for a in args]
+        out_shape = get_shape(node)
+        if out_shape is None or any(s is None for s in shapes):
+            continue
+        inp_einstrs, out_einstr = _get_einstrs(node.args[0])
+        best_cost = einsum_cost(node.args[0], shapes, contract_kwargs)
+        best = None
+        for i, arg in enumerate(args):
+            es = inp_einstrs[i]
+            if len(set(es)) != len(es):
+                continue
+            if not isinstance(arg, fx.Node) or arg.op != "get_attr":
+                continue
+            if arg.target not in candidates:
+                candidates[arg.target] = _get_kronecker_candidates(arg, owner)
+            for left, right in candidates[arg.target]:
+                free = [lab for lab in string.ascii_letters if lab not in node.args[0]]
+                # Indices that both factors have are split in two; the others go to one of them
+                splits = {}
+                for lab, p, q in zip(es, left.shape, right.shape):
+                    if p > 1 and q > 1:
+                        if len(free) == 0:
+                            break
+                        splits[lab] = ((lab, p), (free.pop(0), q))
+                else:
+                    new_inp, new_shapes = [], []
+                    for j, (es_j, shape_j) in enumerate(zip(inp_einstrs, shapes)):
+                        if j == i:
+                            continue
+                        new_es, new_shape = _split_labels(es_j, shape_j, splits)
+                        new_inp.append(new_es)
+                        new_shapes.append(tuple(shape_j) if new_shape is None else new_shape)
+                    factor_inp = [
+                        "".join(
+                            splits[lab][which][0] if lab in splits else lab
+                            for lab, d in zip(es, keep)
+                            if d
+                        )
+                        for which, keep in enumerate(_factor_dims(left, right))
+                    ]
+                    new_out, _ = _split_labels(out_einstr, out_shape, splits)
+                    new_einstr = ",".join(new_inp + factor_inp) + "->" + new_out
+                    cost = einsum_cost(
+                        new_einstr,
+                        new_shapes
+                        + [
+                            tuple(n for n, d in zip(f.shape, keep) if d)
+                            for f, keep in zip((left, right), _factor_dims(left, right))
+                        ],
+                        contract_kwargs,
+                    )
+                    if cost < best_cost:
+                        best_cost = cost
+                        best = (i, left, right, splits, new_einstr)
+        if best is None:
+            continue
+
+        i, left, right, splits, new_einstr = best
+        new_args = []
+        with graph.inserting_before(node):
+            for j, (arg, es_j, shape_j) in enumerate(zip(args, inp_einstrs, shapes)):
+                if j == i:
+                    continue
+                if any(lab in splits for lab in es_j):
+                    arg = graph.call_method("reshape", (arg, _split_shape(graph, arg, es_j, splits)))
+                new_args.append(arg)
+            key = (args[i].target, tuple(left.shape))
+            if key not in registered:
+                names = []
+                for factor, suffix, keep in zip(
+                    (left, right), ("left", "right"), _factor_dims(left, right)
+                ):
+                    factor = factor.reshape(tuple(n for n, d in zip(factor.shape, keep) if d))
+                    base = "_kron_" + args[i].target.replace(".", "_") + "_" + suffix
+                    name = base
+                    k = 0
+                    while hasattr(owner, name):
+                        k += 1
+                        name = f"{base}_{k}"
+                    owner.register_buffer(name, factor)
+                    names.append(name)
+                registered[key] = tuple(names)
+            for name in registered[key]:
+                new_args.append(graph.get_attr(name))
+            if any(lab in splits for lab in out_einstr):
+                # The sizes of the output's indices: the constant's for split ones, and otherwise from operands that have them at runtime
+                out_sizes = []
+                for lab, n in zip(out_einstr, out_shape):
+                    j = next(
+                        (j for j, es_j in enumerate(inp_einstrs) if j != i and lab in es_j and lab not in splits),
+                        None,
+                    )
+                    out_sizes.append(int(n) if j is None else graph.call_method("size", (args[j], inp_einstrs[j].find(lab))))
+        node.args = (new_einstr,) + tuple(new_args)
+        if any(lab in splits for lab in out_einstr):
+            # Unsplit the output
+            with graph.inserting_after(node):
+                new_node = graph.call_method("reshape", tuple())  # placeholder
+                node.replace_all_uses_with(new_node)
+                new_node.args = (node, tuple(out_sizes))
+
+        if len(args[i].users) == 0:
+            graph.erase_node(args[i])
+
+    graph.lint()
+    return graph
@@ -0,0 +1,381 @@
+from typing import Callable, Dict, List, NamedTuple, Optional, Sequence, Tuple
+import copy
+import functools
+
+import torch
+from torch import fx
+
+from ._contract import (
+    _Tensor,
+    _contiguous_stride,
+    _einsum_tensor,
+    _emit_contraction,
+    _permute_tensor,
+)
+from ._cost import _contract_path, _get_contract_kwargs
+from ._dims import _can_view_merge
+from ._fuse import _is_einsum, prod
+from .fx_utils import get_shape, get_stride
+
+
+class _GemmPlan(NamedTuple):
+    """How to compute a pairwise contraction as a (batched) matrix multiplication."""
+
+    batch: str
+    left: str
+    contracted: str
+    right: str
+    # The number of elements that will have to be copied to get the operands into matrix form
+    copy_cost: int
+
+
+def _memory_order(t: _Tensor, labels: Sequence[str]) -> str:
+    """Sort ``labels`` from the outermost to the innermost in ``t``'s memory."""
+    return "".join(sorted(labels, key=lambda lab: -t.stride[t.labels.index(lab)]))
+
+
+def _is_matrix_view(t: _Tensor, batch: str, rows: str, cols: str) -> bool:
+    """Whether ``t`` can be viewed, without a copy, as a batch of matrices that BLAS can use directly."""
+    inner_strides = []
+    for group in (batch, rows, cols):
+        dims = [t.labels.index(lab) for lab in group]
+        sizes = [t.shape[d] for d in dims]
+        strides = [t.stride[d] for d in dims]
+        if not _can_view_merge(sizes, strides):
+            return False
+        nontrivial = [s for n, s in zip(sizes, strides) if n != 1]
+        inner_strides.append(nontrivial[-1] if len(nontrivial) > 0 else None)
+    _, row_stride, col_stride = inner_strides
+    # BLAS can deal with either a row-major or a column-major matrix, but one of the two has to be contiguous
+    return row_stride is None or col_stride is None or row_stride == 1 or col_stride == 1
+
+
+def _plan_gemm(a: _Tensor, b: _Tensor, keep: str) -> Optional[_GemmPlan]:
+    """Plan the contraction of ``a`` and ``b`` into the indices ``keep`` as a matrix multiplication.
+
+    Indices that only one of ``a`` and ``b`` have and that aren't kept must already have been summed out.
+
+    Returns:
+        The plan with the fewest copies, or ``None`` if this isn't a matrix multiplication.
+    """
+    if len(set(a.labels)) != len(a.labels) or len(set(b.labels)) != len(b.labels):
+        # Diagonals
+        return None
+    shared = set(a.labels) & set(b.labels)
+    if any(a.shape[a.labels.index(lab)] != b.shape[b.labels.index(lab)] for lab in shared):
+        # Broadcasting
+        return None
+    contracted = [lab for lab in a.labels if lab in shared and lab not in keep]
+    left = _memory_order(a, [lab for lab in a.labels if lab not in shared])
+    right = _memory_order(b, [lab for lab in b.labels if lab not in shared])
+    if len(contracted) == 0 or (len(left) == 0 and len(right) == 0):
+        # Nothing for a matrix multiplication to do
+        return None
+    batch = [lab for lab in a.labels if lab in shared and lab in keep]
+    best = None
+    # The batch and contracted indices have to be flattened in the same order in both operands,
+    # so follow the layout of one of them and maybe copy the other
+    for src in (a, b):
+        src_batch = _memory_order(src, batch)
+        src_contracted = _memory_order(src, contracted)
+        copy_cost = 0
+        if not _is_matrix_view(a, src_batch, left, src_contracted):
+            copy_cost += prod(a.shape)
+        if not _is_matrix_view(b, src_batch, src_contracted, right):
+            copy_cost += prod(b.shape)
+        if best is None or copy_cost < best.copy_cost:
+            best = _GemmPlan(src_batch, left, src_contracted, right, copy_cost)
+    return best
+
+
+def _as_matrix(graph: fx.Graph, t: _Tensor, batch: str, rows: str, cols: str):
+    """View ``t`` as a (batch of) matrices, copying only if we have to, without fixing its sizes."""
+    t = _permute_tensor(graph, t, batch + rows + cols)
+    node = t.node
+    # Flatten each group of indices, or add a dimension for an empty one, going backwards so that the earlier groups' numbering doesn't change
+    start = len(batch) + len(rows) + len(cols)
+    for group in (cols, rows) + ((batch,) if len(batch) > 0 else ()):
+        start -= len(group)
+        if len(group) == 0:
+            node = graph.call_method("unsqueeze", (node, start))
+        elif len(group) > 1:
+            node = graph.call_method("flatten", (node, start, start + len(group) - 1))
+    return node
+
+
+def _emit_gemm(
+    graph: fx.Graph, a: _Tensor, b: _Tensor, plan: _GemmPlan, transpose: bool
+) -> _Tensor:
+    """Emit ``plan`` as a ``mm`` or ``bmm``.
+
+    If ``transpose``, the product is computed transposed, so that the result has the indices of ``b`` before those of ``a``.
+    """
+    if transpose:
+        (a, left), (b, right) = (b, plan.right), (a, plan.left)
+    else:
+        left, right = plan.left, plan.right
+    x = _as_matrix(graph, a, plan.batch, left, plan.contracted)
+    y = _as_matrix(graph, b, plan.batch, plan.contracted, right)
+    out = graph.call_function(torch.bmm if len(plan.batch) > 0 else torch.mm, (x, y))
+    labels = plan.batch + left + right
+    sizes = {lab: n for t in (a, b) for lab, n in zip(t.labels, t.shape)}
+    shape = tuple(sizes[lab] for lab in labels)
+    if any(len(group) != 1 for group in ((plan.batch,) if len(plan.batch) > 0 else ()) + (left, right)):
+        # Unflatten the result with the operands' sizes at runtime
+        out = graph.call_method(
+            "reshape",
+            (
+                out,
+                tuple(
+                    graph.call_method("size", (t.node, t.labels.index(lab)))
+                    for lab in labels
+                    for t in [a if lab in a.labels else b]
+                ),
+            ),
+        )
+    return _Tensor(
+        node=out,
+        labels=labels,
+        shape=shape,
+        stride=_contiguous_stride(shape),
+    )
+
+
+def _sum_out(graph: fx.Graph, t: _Tensor, needed: str) -> _Tensor:
+    """Sum out the indices of ``t`` that aren't in ``needed``."""
+    dims = tuple(d for d, lab in enumerate(t.labels) if lab not in needed)
+    if len(dims) == 0 or len(set(t.labels)) != len(t.labels):
+        return t
+    shape = tuple(n for d, n in enumerate(t.shape) if d not in dims)
+    return _Tensor(
+        node=graph.call_method("sum", (t.node, dims)),
+        labels="".join(lab for lab in t.labels if lab in needed),
+        shape=shape,
+        stride=_contiguous_stride(shape),
+    )
+
+
+def _emit_layout_aware_step(
+    graph: fx.Graph,
+    operands: List[_Tensor],
+    contraction: tuple,
+    prefer: Callable[[str], int],
+    copy_costs: Optional[List[int]] = None,
+) -> _Tensor:
+    """Emit one step of a contraction, using BLAS on the operands' existing layouts where possible.
+
+    If ``copy_costs`` is given, the number of elements that the step will copy is appended to it.
+    """
+    results_index = contraction[2].split("->")[1]
+    if len(operands) == 2:
+        a, b = operands
+        a = _sum_out(graph, a, b.labels + results_index)
+        b = _sum_out(graph, b, a.labels + results_index)
+        plan = _plan_gemm(a, b, results_index)
+        if plan is not None:
+            # We can get the result either way around for free; pick the one that suits what comes next
+            transpose = prefer(plan.batch + plan.right + plan.left) < prefer(
+                plan.batch + plan.left + plan.right
+            )
+            if copy_costs is not None:
+                copy_costs.append(plan.copy_cost)
+            return _emit_gemm(graph, a, b, plan, transpose)
+        operands = [a, b]
+    return _einsum_tensor(graph, operands, results_index)
+
+
+class _DryRunGraph:
+    """Stands in for an ``fx.Graph`` to work out what emitting a contraction would do without emitting anything."""
+
+    def call_method(self, *args, **kwargs):
+        return None
+
+    def call_function(self, *args, **kwargs):
+        return None
+
+
+def _layout_copy_cost(
+    operands: List[_Tensor], contraction_list: Sequence[tuple], output_subscript: str
+) -> Tuple[int, _Tensor]:
+    """The number of elements a layout-aware emission of a contraction copies, and the layout of its result."""
+    costs: List[int] = []
+    out = _emit_contraction(
+        _DryRunGraph(),
+        operands,
+        contraction_list,
+        output_subscript,
+        emit_step=functools.partial(_emit_layout_aware_step, copy_costs=costs),
+    )
+    return sum(costs), out
+
+
+def _relabel(labels: str, old_out: str, new_out: str) -> str:
+    """Reorder the labels a consumer gives to a tensor labeled ``old_out`` by its producer once the producer outputs ``new_out`` instead."""
+    return "".join(labels[old_out.index(lab)] for lab in new_out)
+
+
+class _EinsumInfo(NamedTuple):
+    inputs: List[str]
+    output: str
+    shapes: List[Tuple[int, ...]]
+    contraction_list: list
+    size_dict: Dict[str, int]
+
+
+def _consumer_orders(info: _EinsumInfo, pos: int) -> List[str]:
+    """The orders, in the consumer's labels, that make input ``pos`` of a contraction directly usable as a matrix by the step that consumes it."""
+    labels = info.inputs[pos]
+    if len(set(labels)) != len(labels):
+        return []
+    ids = list(range(len(info.inputs)))
+    for contraction in info.contraction_list:
+        inds, _, einsum_str, _, _ = contraction
+        popped = [ids.pop(x) for x in inds]
+        if pos in popped:
+            input_str, results_index = einsum_str.split("->")
+            others = set(
+                "".join(
+                    inp for i, inp in zip(popped, input_str.split(",")) if i != pos
+                )
+            )
+            break
+        ids.append(None)
+    summed = "".join(lab for lab in labels if lab not in others and lab not in results_index)
+    batch = "".join(lab for lab in labels if lab in others and lab in results_index)
+    free = "".join(lab for lab in labels if lab not in others and lab in results_index)
+    contracted = "".join(lab for lab in labels if lab in others and lab not in results_index)
+    return [summed + batch + free + contracted, summed + batch + contracted + free]
+
+
+def assign_einsum_layouts(
+    graph: fx.Graph,
+    contract_kwargs: dict = {},
+    in_place: bool = False,
+    max_sweeps: int = 4,
+) -> fx.Graph:
+    """Choose the index order of intermediate einsum results jointly across the graph.
+
+    The order of the output indices of an einsum whose result is only used by other einsums is arbitrary: the consumers' subscripts can be rewritten to match any order. With ``optimize_einsums(..., layout_aware=True)``, that order determines whether the consumers can use the intermediate as a matrix directly or have to copy it into a different layout first, and whether the producer can write it out that way for free. Since one intermediate can feed several consumers, and a consumer's own result can feed further einsums, this is chosen for all intermediates together by coordinate descent over a small set of candidate orders --- each node's current order, and the orders that suit each of the steps that consume it --- minimizing the total number of elements that the layout-aware emission of all einsums in the graph would copy.
+
+    This requires shape information such as that populated by ``ShapeProp``; einsums without it are left alone. The recorded shapes of the rewritten einsums are updated, so ``optimize_einsums`` can be run directly afterwards.
+
+    Args:
+        graph: the graph to process.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``; should match those given to ``optimize_einsums``.
+        in_place (bool, optional): whether to process ``graph`` in place.
+        max_sweeps (int, optional): the maximum number of passes over all the intermediates.
+
+    Returns:
+        The graph with reordered einsum outputs.
+    """
+    contract_kwargs = _get_contract_kwargs(contract_kwargs)
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    infos: Dict[fx.Node, _EinsumInfo] = {}
+    for node in graph.nodes:
+        if not _is_einsum(node) or "..." in node.args[0]:
+            continue
+        if not all(isinstance(a, fx.Node) for a in node.args[1:]):
+            continue
+        shapes = [get_shape(a) for a in node.args[1:]]
+        if any(s is None for s in shapes):
+            continue
+        shapes = [tuple(int(n) for n in s) for s in shapes]
+        _, path_info = _contract_path(node.args[0], shapes, contract_kwargs)
+        infos[node] = _EinsumInfo(
+            inputs=path_info.input_subscripts.split(","),
+            output=path_info.output_subscript,
+            shapes=shapes,
+            contraction_list=path_info.contraction_list,
+            size_dict={lab: int(n) for lab, n in path_info.size_dict.items()},
+        )
+
+    # The intermediates whose order we are free to choose
+    candidates: Dict[fx.Node, List[str]] = {}
+    for node, info in infos.items():
+        if len(node.users) == 0 or not all(user in infos for user in node.users):
+            continue
+        orders = [info.output]
+        for user in node.users:
+            user_info = infos[user]
+            for pos, arg in enumerate(user.args[1:]):
+                if arg is not node:
+                    continue
+                for order in _consumer_orders(user_info, pos):
+                    order = _relabel(info.output, user_info.inputs[pos], order)
+                    if order not in orders:
+                        orders.append(order)
+        if len(orders) > 1:
+            candidates[node] = orders
+    if len(candidates) == 0:
+        return graph
+
+    def input_labels(node: fx.Node, order: Dict[fx.Node, str]) -> List[str]:
+        return [
+            _relabel(labels, infos[arg].output, order[arg]) if arg in order else labels
+            for arg, labels in zip(node.args[1:], infos[node].inputs)
+        ]
+
+    def total_cost(order: Dict[fx.Node, str]) -> int:
+        cost = 0
+        results: Dict[fx.Node, _Tensor] = {}
+        for node, info in infos.items():
+            operands = []
+            for arg, labels, shape in zip(
+                node.args[1:], input_labels(node, order), info.shapes
+            ):
+                if arg in results:
+                    operands.append(results[arg]._replace(labels=labels))
+                else:
+                    stride = get_stride(arg)
+                    operands.append(
+                        _Tensor(
+                            node=None,
+                            labels=labels,
+                            shape=shape,
+                            stride=_contiguous_stride(shape) if stride is None else stride,
+                        )
+                    )
+            step_cost, results[node] = _layout_copy_cost(
+                operands, info.contraction_list, order.get(node, info.output)
+            )
+            cost += step_cost
+        return cost
+
+    order = {node: orders[0] for node, orders in candidates.items()}
+    best = total_cost(order)
+    for _ in range(max_sweeps):
+        improved = False
+        for node, orders in candidates.items():
+            for candidate in orders:
+                if candidate == order[node]:
+                    continue
+                trial = dict(order)
+                trial[node] = candidate
+                cost = total_cost(trial)
+                if cost < best:
+                    best, order, improved = cost, trial, True
+        if not improved:
+            break
+
+    changed = {node: o for node, o in order.items() if o != infos[node].output}
+    for node, info in infos.items():
+        if node not in changed and not any(arg in changed for arg in node.args[1:]):
+            continue
+        out = changed.get(node, info.output)
+        node.args = (",".join(input_labels(node, changed)) + "->" + out,) + tuple(
+            node.args[1:]
+        )
+        if node in changed:
+            shape = tuple(info.size_dict[lab] for lab in out)
+            meta = node.meta.get("tensor_meta", None)
+            if meta is not None:
+                node.meta["tensor_meta"] = meta._replace(
+                    shape=torch.Size(shape), stride=_contiguous_stride(shape)
+                )
+            elif hasattr(node, "shape"):
+                node.shape = torch.Size(shape)
+
+    graph.lint()
+    return graph
@@ -0,0 +1,224 @@
+from typing import Any, Callable, Dict, List, Optional, Sequence
+import operator
+import warnings
+
+import torch
+from torch import fx
+
+from ._contract import (
+    _Tensor,
+    _contiguous_stride,
+    _emit_opt_einsum_step,
+    _permute_tensor,
+)
+from ._codegen import _CODEGEN_DTYPES, _batched_matmul_source, _compile
+from ._layout import _sum_out
+from ._sparse import _emit_structured
+from ._fuse import prod
+from ._symmetric import _emit_gram
+
+# torch.linalg.vecdot was added in PyTorch 2.0
+_HAS_VECDOT: bool = hasattr(torch, "linalg") and hasattr(torch.linalg, "vecdot")
+
+# Batched matrix products with at most this many multiplications per batch element...
+_TINY_MATMUL_MAX_FLOPS: int = 128
+# ...and at least this many batch elements are computed by a compiled kernel rather than with bmm
+_TINY_MATMUL_MIN_BATCH: int = 1024
+
+
+def _take_diagonals(graph: fx.Graph, t: _Tensor) -> _Tensor:
+    """Take the diagonal over every index that ``t`` has more than once."""
+    while len(set(t.labels)) != len(t.labels):
+        lab = next(lab for lab in t.labels if t.labels.count(lab) > 1)
+        d1 = t.labels.index(lab)
+        d2 = t.labels.index(lab, d1 + 1)
+        keep = [d for d in range(len(t.labels)) if d not in (d1, d2)]
+        # torch.diagonal puts the diagonal last
+        t = _Tensor(
+            node=graph.call_function(
+                torch.diagonal, (t.node,), {"dim1": d1, "dim2": d2}
+            ),
+            labels="".join(t.labels[d] for d in keep) + lab,
+            shape=tuple(t.shape[d] for d in keep) + (t.shape[d1],),
+            stride=tuple(t.stride[d] for d in keep) + (t.stride[d1] + t.stride[d2],),
+        )
+    return t
+
+
+def _unsqueeze_to(graph: fx.Graph, t: _Tensor, labels: str) -> _Tensor:
+    """View ``t`` with the indices ``labels``, in that order, adding size-1 dimensions for indices it doesn't have."""
+    t = _permute_tensor(graph, t, "".join(lab for lab in labels if lab in t.labels))
+    for d, lab in enumerate(labels):
+        if lab in t.labels:
+            continue
+        stride = t.stride[d] * t.shape[d] if d < len(t.shape) else 1
+        t = _Tensor(
+            node=graph.call_method("unsqueeze", (t.node, d)),
+            labels=t.labels[:d] + lab + t.labels[d:],
+            shape=t.shape[:d] + (1,) + t.shape[d:],
+            stride=t.stride[:d] + (stride,) + t.stride[d:],
+        )
+    return t
+
+
+def _broadcast_mul(graph: fx.Graph, operands: Sequence[_Tensor], labels: str) -> _Tensor:
+    """Multiply ``operands`` elementwise, broadcasting them to the indices ``labels``."""
+    operands = [_unsqueeze_to(graph, t, labels) for t in operands]
+    node = operands[0].node
+    for t in operands[1:]:
+        node = graph.call_function(operator.mul, (node, t.node))
+    shape = tuple(max(t.shape[d] for t in operands) for d in range(len(labels)))
+    return _Tensor(
+        node=node, labels=labels, shape=shape, stride=_contiguous_stride(shape)
+    )
+
+
+def _dot(graph: fx.Graph, a: _Tensor, b: _Tensor, keep: str, vecdot: bool) -> _Tensor:
+    """Contract ``a`` and ``b``, which have the same indices, over the indices not in ``keep``."""
+    b = _permute_tensor(graph, b, a.labels)
+    dims = tuple(d for d, lab in enumerate(a.labels) if lab not in keep)
+    labels = "".join(lab for lab in a.labels if lab in keep)
+    shape = tuple(
+        max(n, m) for d, (n, m) in enumerate(zip(a.shape, b.shape)) if d not in dims
+    )
+    if vecdot and len(dims) == 1:
+        node = graph.call_function(
+            torch.linalg.vecdot, (a.node, b.node), {"dim": dims[0]}
+        )
+    else:
+        node = graph.call_method(
+            "sum", (graph.call_function(operator.mul, (a.node, b.node)), dims)
+        )
+    return _Tensor(
+        node=node, labels=labels, shape=shape, stride=_contiguous_stride(shape)
+    )
+
+
+def _tiny_matmul(
+    graph: fx.Graph,
+    operands: List[_Tensor],
+    needed: List[str],
+    results_index: str,
+    codegen_dtype: Optional[torch.dtype],
+) -> Optional[_Tensor]:
+    """Emit a batched product of tiny matrices with a kernel compiled for their sizes, if it is one and ``codegen_dtype`` is given.
+
+    ``bmm`` dispatches to a general matrix multiplication for each pair of matrices, which for matrices of a few elements is all overhead. The kernel is a loop nest whose trip counts are compile-time constants, so the compiler can unroll and vectorize it, parallelized across the batch; only the batch size is left to runtime.
+    """
+    if codegen_dtype is None or codegen_dtype not in _CODEGEN_DTYPES:
+        return None
+    sizes = dict(zip(operands[0].labels + operands[1].labels, operands[0].shape + operands[1].shape))
+    # Indices that only one operand has and that aren't kept are summed out first
+    a, b = ["".join(lab for lab in t.labels if lab in n) for t, n in zip(operands, needed)]
+    shared = [lab for lab in a if lab in b]
+    batch = "".join(lab for lab in shared if lab in results_index)
+    contracted = "".join(lab for lab in shared if lab not in results_index)
+    left = "".join(lab for lab in a if lab not in b)
+    right = "".join(lab for lab in b if lab not in a)
+    if len(batch) == 0 or any(sizes[lab] != n for t in operands for lab, n in zip(t.labels, t.shape)):
+        # Nothing to batch over, or broadcasting, which the kernel doesn't do
+        return None
+    rows, inner, cols = (prod(sizes[lab] for lab in g) for g in (left, contracted, right))
+    if (
+        prod(sizes[lab] for lab in batch) < _TINY_MATMUL_MIN_BATCH
+        or rows * inner * cols > _TINY_MATMUL_MAX_FLOPS
+    ):
+        return None
+    try:
+        op = _compile(_batched_matmul_source(rows, inner, cols, codegen_dtype))
+    except Exception as e:
+        warnings.warn(
+            f"Could not compile a {rows}x{inner} by {inner}x{cols} batched matrix product: {e}; using bmm",
+            RuntimeWarning,
+        )
+        return None
+    a, b = [_sum_out(graph, t, n) for t, n in zip(operands, needed)]
+    a = _permute_tensor(graph, a, batch + left + contracted)
+    b = _permute_tensor(graph, b, batch + contracted + right)
+    # The batch size is only known at runtime
+    out = graph.call_function(
+        op,
+        (
+            graph.call_method("reshape", (a.node, (-1, rows, inner))),
+            graph.call_method("reshape", (b.node, (-1, inner, cols))),
+        ),
+    )
+    labels = batch + left + right
+    shape = tuple(sizes[lab] for lab in labels)
+    if len(batch) != 1 or len(left) != 1 or len(right) != 1:
+        out = graph.call_method(
+            "reshape",
+            (
+                out,
+                tuple(graph.call_method("size", (a.node, d)) for d in range(len(batch)))
+                + tuple(sizes[lab] for lab in left + right),
+            ),
+        )
+    return _Tensor(
+        node=out, labels=labels, shape=shape, stride=_contiguous_stride(shape)
+    )
+
+
+def _lower_step(
+    graph: fx.Graph,
+    operands: List[_Tensor],
+    results_index: str,
+    vecdot: bool,
+    codegen_dtype: Optional[torch.dtype] = None,
+) -> Optional[_Tensor]:
+    """Emit a step as native reductions and elementwise operations, if it is one of the kinds that ``torch.einsum`` and BLAS handle badly."""
+    if len(operands) == 1:
+        # Traces, diagonals, and reductions
+        t = _take_diagonals(graph, operands[0])
+        return _sum_out(graph, t, results_index)
+    if any(len(set(t.labels)) != len(t.labels) for t in operands):
+        return None
+    # Indices that only one operand has and that aren't kept can be summed out first
+    needed = [
+        results_index + "".join(o.labels for j, o in enumerate(operands) if j != i)
+        for i in range(len(operands))
+    ]
+    remaining = [set(lab for lab in t.labels if lab in n) for t, n in zip(operands, needed)]
+    if all(lab in results_index for labels in remaining for lab in labels):
+        # Hadamard and outer products
+        operands = [_sum_out(graph, t, n) for t, n in zip(operands, needed)]
+        return _broadcast_mul(graph, operands, results_index)
+    if len(operands) == 2 and remaining[0] == remaining[1]:
+        # Batched dot products, which are too thin to be worth a matrix multiplication
+        operands = [_sum_out(graph, t, n) for t, n in zip(operands, needed)]
+        return _dot(graph, operands[0], operands[1], results_index, vecdot)
+    if len(operands) == 2:
+        # Batches of matrix products that are too small to be worth a matrix multiplication each
+        return _tiny_matmul(graph, operands, needed, results_index, codegen_dtype)
+    return None
+
+
+def _emit_native_step(
+    graph: fx.Graph,
+    operands: List[_Tensor],
+    contraction: tuple,
+    prefer: Callable[[str], int],
+    fallback: Optional[Callable[..., _Tensor]] = None,
+    vecdot: bool = False,
+    structured: Dict[fx.Node, Any] = {},
+    codegen_dtype: Optional[torch.dtype] = None,
+) -> _Tensor:
+    """Emit one step of a contraction, lowering single-operand, Hadamard, and dot product steps to native operations, products of a tensor with itself to symmetric products, products with the sparse or block-diagonal operands ``structured`` to products that skip their zeros, and if ``codegen_dtype`` is given, tiny batched matrix products of operands of that dtype to compiled kernels.
+
+    Other steps are emitted by ``fallback(graph, operands, contraction, prefer)``; if ``fallback`` is ``None``, they are emitted like ``opt_einsum.contract`` would, and lowered steps put their result in the order ``opt_einsum`` expects.
+
+    If ``vecdot``, dot products over a single index use ``torch.linalg.vecdot``, which conjugates its first argument and so must only be used for real operands.
+    """
+    results_index = contraction[2].split("->")[1]
+    new = _emit_structured(graph, operands, results_index, structured)
+    if new is None:
+        new = _emit_gram(graph, operands, results_index)
+    if new is None:
+        new = _lower_step(graph, operands, results_index, vecdot, codegen_dtype)
+    if new is None:
+        if fallback is None:
+            return _emit_opt_einsum_step(graph, operands, contraction)
+        return fallback(graph, operands, contraction, prefer)
+    if fallback is None or prefer(results_index) < prefer(new.labels):
+        new = _permute_tensor(graph, new, results_index)
+    return new
@@ -0,0 +1,254 @@
+from typing import List, Optional, Tuple
+import copy
+import operator
+
+import torch
+from torch import fx
+
+from ._cost import _contract_path, _get_contract_kwargs
+from ._fuse import _get_einstrs, _is_einsum
+from .fx_utils import get_dtype, get_shape
+
+# The number of edges gathered, contracted, and scattered at once
+_MESSAGE_CHUNK_SIZE: int = 2 ** 14
+
+_INDEX_DTYPES = {torch.int32, torch.int64}
+_ZEROS_FUNCS = {torch.zeros, torch.zeros_like}
+
+
+def _gather_einsum_scatter(
+    out: torch.Tensor,
+    out_dim: int,
+    dst: torch.Tensor,
+    operands: List[torch.Tensor],
+    dims: List[int],
+    gathers: List[int],
+    indices: List[torch.Tensor],
+    step_inputs: List[List[int]],
+    step_equations: List[str],
+    n_hoisted: int,
+    chunk_size: int,
+) -> torch.Tensor:
+    """Contract ``operands`` and ``index_add_`` the result into ``out`` along ``out_dim`` at ``dst``, a chunk of edges at a time.
+
+    ``dims[i]`` is the edge dimension of ``operands[i]``, or -1 if it has none. If ``gathers[i]`` isn't -1, ``operands[i]`` is gathered along its edge dimension by ``indices[gathers[i]]`` first.
+
+    The contraction is done in steps: step ``k`` is ``torch.einsum(step_equations[k], ...)`` of the values numbered ``step_inputs[k]``, where the operands are numbered first and then the result of each step. The first ``n_hoisted`` steps don't involve edges, so they are done once, before the chunks.
+    """
+    values: List[torch.Tensor] = list(operands)
+    for k in range(n_hoisted):
+        values.append(torch.einsum(step_equations[k], [values[i] for i in step_inputs[k]]))
+    n_edges = dst.shape[0]
+    for start in range(0, n_edges, chunk_size):
+        length = min(chunk_size, n_edges - start)
+        chunk: List[torch.Tensor] = list(values)
+        for i in range(len(operands)):
+            if gathers[i] >= 0:
+                chunk[i] = operands[i].index_select(
+                    dims[i], indices[gathers[i]].narrow(0, start, length)
+                )
+            elif dims[i] >= 0:
+                chunk[i] = operands[i].narrow(dims[i], start, length)
+        for k in range(n_hoisted, len(step_equations)):
+            chunk.append(torch.einsum(step_equations[k], [chunk[i] for i in step_inputs[k]]))
+        out.index_add_(out_dim, dst.narrow(0, start, length), chunk[-1])
+    return out
+
+
+def _chunk_steps(
+    equation: str, shapes: List[Tuple[int, ...]], dims: List[int], contract_kwargs: dict
+) -> Tuple[List[List[int]], List[str], int]:
+    """Find a contraction path for one chunk, and order its steps so that those that don't involve edges come first.
+
+    Returns:
+        The arguments ``step_inputs``, ``step_equations``, and ``n_hoisted`` of ``_gather_einsum_scatter``.
+    """
+    _, path_info = _contract_path(equation, shapes, contract_kwargs)
+    n = len(shapes)
+    ids = list(range(n))
+    # Whether each value depends on the edges
+    per_edge = [d >= 0 for d in dims]
+    steps = []
+    for k, (inds, _, einsum_str, _, _) in enumerate(path_info.contraction_list):
+        inputs = [ids.pop(x) for x in inds]
+        per_edge.append(any(per_edge[i] for i in inputs))
+        steps.append((inputs, einsum_str, n + k))
+        ids.append(n + k)
+    order = [step for step in steps if not per_edge[step[2]]] + [
+        step for step in steps if per_edge[step[2]]
+    ]
+    # Renumber the results in the order they are computed
+    number = {step[2]: n + k for k, step in enumerate(order)}
+    number.update((i, i) for i in range(n))
+    return (
+        [[number[i] for i in inputs] for inputs, _, _ in order],
+        [einsum_str for _, einsum_str, _ in order],
+        sum(not per_edge[step[2]] for step in steps),
+    )
+
+
+def _is_index(node) -> bool:
+    """Whether ``node`` is known to be a vector of indices."""
+    if not isinstance(node, fx.Node):
+        return False
+    shape = get_shape(node)
+    return shape is not None and len(shape) == 1 and get_dtype(node) in _INDEX_DTYPES
+
+
+def _get_gather(node: fx.Node) -> Optional[Tuple[fx.Node, int, fx.Node]]:
+    """If ``node`` selects entries of a tensor by a vector of indices, get the tensor, dimension, and indices."""
+    if node.op == "call_function" and node.target is operator.getitem:
+        x, idx = node.args
+        dim = 0
+    elif (
+        node.op == "call_function" and node.target is torch.index_select
+    ) or (node.op == "call_method" and node.target == "index_select"):
+        if len(node.args) != 3 or len(node.kwargs) > 0:
+            return None
+        x, dim, idx = node.args
+    else:
+        return None
+    if not isinstance(x, fx.Node) or not isinstance(dim, int) or not _is_index(idx):
+        return None
+    return x, dim, idx
+
+
+def _get_scatter(node: fx.Node) -> Optional[Tuple[fx.Node, int, fx.Node, fx.Node, bool]]:
+    """If ``node`` is an ``index_add``, get its base, dimension, indices, source, and whether it is in place."""
+    if node.op == "call_function" and node.target is torch.index_add:
+        in_place = False
+    elif node.op == "call_method" and node.target in ("index_add", "index_add_"):
+        in_place = node.target == "index_add_"
+    else:
+        return None
+    if len(node.args) != 4 or len(node.kwargs) > 0:
+        # index_add with an alpha isn't handled
+        return None
+    base, dim, dst, src = node.args
+    if not isinstance(dim, int) or not _is_index(dst) or not isinstance(src, fx.Node):
+        return None
+    return base, dim, dst, src, in_place
+
+
+def _is_fresh_zeros(node: fx.Node) -> bool:
+    """Whether ``node`` is a tensor of zeros that nothing else uses."""
+    return len(node.users) == 1 and (
+        (node.op == "call_function" and node.target in _ZEROS_FUNCS)
+        or (node.op == "call_method" and node.target == "new_zeros")
+    )
+
+
+def fuse_message_passing(
+    graph: fx.Graph,
+    contract_kwargs: dict = {},
+    chunk_size: int = _MESSAGE_CHUNK_SIZE,
+    in_place: bool = False,
+) -> fx.Graph:
+    """Fuse gathers of node features, einsums over edges, and scatters back to nodes.
+
+    Message passing layers gather node features onto edges, contract them with per-edge features, and add the results up per node:
+
+    .. code-block:: python
+
+        messages = torch.einsum("ei,ej,ijk->ek", x[edge_src], edge_attr, weight)
+        out = torch.zeros_like(x).index_add(0, edge_dst, messages)
+
+    The gathered features and the messages have an entry per edge, and are usually much bigger than anything per node. This replaces such patterns with ``_gather_einsum_scatter``, which gathers, contracts, and scatters ``chunk_size`` edges at a time, so that only chunk-sized per-edge tensors are ever allocated. Each chunk is contracted along a path found with ``opt_einsum`` for chunk-sized operands, and the steps of the path that don't involve edges are done once, before the chunks.
+
+    Gathers are indexing with a vector of indices (``x[idx]``) or ``index_select``; scatters are ``index_add`` and ``index_add_``. The gathered tensors and the einsum must have no other users, and the einsum must have the scattered dimension's index in the same position in all of its per-edge operands. This requires shape and dtype information such as that populated by ``ShapeProp``, to tell vectors of indices from other indices and to find contraction paths.
+
+    Args:
+        graph: the graph to process.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
+        chunk_size (int, optional): the number of edges to process at once.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with fused message passing.
+    """
+    contract_kwargs = _get_contract_kwargs(contract_kwargs)
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    for node in list(graph.nodes):
+        scatter = _get_scatter(node)
+        if scatter is None:
+            continue
+        base, out_dim, dst, einsum, scatter_in_place = scatter
+        if not _is_einsum(einsum) or len(einsum.users) != 1 or "..." in einsum.args[0]:
+            continue
+        inp_einstrs, out_einstr = _get_einstrs(einsum.args[0])
+        if out_dim < 0 or out_dim >= len(out_einstr):
+            continue
+        edge = out_einstr[out_dim]
+        shapes = [get_shape(a) if isinstance(a, fx.Node) else None for a in einsum.args[1:]]
+        if any(s is None for s in shapes):
+            continue
+        operands, dims, gathers, indices = [], [], [], []
+        for arg, es in zip(einsum.args[1:], inp_einstrs):
+            if es.count(edge) > 1:
+                break
+            dim = es.find(edge)
+            gather = _get_gather(arg) if isinstance(arg, fx.Node) else None
+            if gather is not None and len(arg.users) == 1 and gather[1] == dim:
+                x, _, idx = gather
+                operands.append(x)
+                gathers.append(len(indices))
+                indices.append(idx)
+            else:
+                operands.append(arg)
+                gathers.append(-1)
+            dims.append(dim)
+        else:
+            if len(indices) == 0:
+                # Nothing is gathered; the einsum's own output is all there is to save
+                continue
+            # The shapes of the operands of a chunk
+            chunk_shapes = [
+                tuple(
+                    min(int(n), chunk_size) if lab == edge else int(n)
+                    for lab, n in zip(es, shape)
+                )
+                for es, shape in zip(inp_einstrs, shapes)
+            ]
+            step_inputs, step_equations, n_hoisted = _chunk_steps(
+                ",".join(inp_einstrs) + "->" + out_einstr,
+                chunk_shapes,
+                dims,
+                contract_kwargs,
+            )
+            with graph.inserting_before(node):
+                out = base
+                if not scatter_in_place and not _is_fresh_zeros(base):
+                    # The scatter is accumulated in place, so it needs its own copy
+                    out = graph.call_method("clone", (base,))
+                new_node = graph.call_function(
+                    _gather_einsum_scatter,
+                    (
+                        out,
+                        out_dim,
+                        dst,
+                        operands,
+                        dims,
+                        gathers,
+                        indices,
+                        step_inputs,
+                        step_equations,
+                        n_hoisted,
+                        chunk_size,
+                    ),
+                )
+            node.replace_all_uses_with(new_node)
+            graph.erase_node(node)
+            gathered = {
+                a: None
+                for a in einsum.args[1:]
+                if isinstance(a, fx.Node) and _get_gather(a) is not None
+            }
+            graph.erase_node(einsum)
+            for a in gathered:
+                if len(a.users) == 0:
+                    graph.erase_node(a)
+
+    graph.lint()
+    return graph
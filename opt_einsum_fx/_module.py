@@ -0,0 +1,177 @@
+from collections import OrderedDict
+from typing import Any, Callable, Dict, Hashable, Optional, Set, Union
+import threading
+import warnings
+
+import torch
+from torch import fx
+
+from ._opt_ein import optimize_einsums_full
+
+
+def _signature(args: tuple) -> Hashable:
+    """A key for ``args`` that is the same for all arguments that ``optimize_einsums_full`` would optimize for in the same way."""
+    key = []
+    for x in args:
+        if isinstance(x, torch.Tensor):
+            key.append(
+                (
+                    "tensor",
+                    tuple(x.shape),
+                    # Dimensions are merged according to the strides, even when the passes aren't layout-aware
+                    tuple(x.stride()),
+                    x.dtype,
+                    x.device,
+                    # Gradient-aware options depend on which operands need gradients
+                    x.requires_grad,
+                )
+            )
+        else:
+            # Other arguments can change what gets traced, so they are part of the key by value
+            value = x
+            try:
+                hash(value)
+            except TypeError:
+                value = repr(value)
+            key.append((type(x), value))
+    return tuple(key)
+
+
+def _copy_args(args: tuple) -> tuple:
+    """Copy the tensors in ``args``, with their strides and ``requires_grad``, so the caller is free to change them."""
+    out = []
+    for x in args:
+        if isinstance(x, torch.Tensor):
+            copy = torch.empty_strided(
+                x.shape, x.stride(), dtype=x.dtype, device=x.device
+            )
+            copy.copy_(x.detach())
+            x = copy.requires_grad_(x.requires_grad)
+        out.append(x)
+    return tuple(out)
+
+
+class OptimizedModule(torch.nn.Module):
+    """A module that optimizes the einsums of ``model`` just in time, for the inputs it is actually called with.
+
+    ``model`` is traced once, when the ``OptimizedModule`` is created. On the first call with arguments of a new signature --- the shapes, strides, dtypes, devices, and ``requires_grad`` of tensor arguments, and the values of other arguments --- the traced model is optimized with ``optimize_einsums_full`` using copies of those arguments as the example inputs. The optimized variant is cached, and later calls with the same signature are dispatched to it directly. At most ``max_variants`` variants are kept; the least recently used one is dropped to make room for a new one.
+
+    If ``background`` is true, calls with a new signature don't wait for the optimization: they are served by the unoptimized traced model while ``optimize_einsums_full`` runs on a background thread, with copies of the arguments. Once the optimized variant is ready it is swapped into the cache, so that later calls use it, and ``on_swap`` is called with the signature and the variant, from the background thread. ``num_swaps`` counts the variants swapped in so far. If the optimization fails, a warning is issued and the signature keeps being served by the unoptimized model.
+
+    The variants share the parameters and buffers of ``model``, which is registered as the submodule ``module``. Copies, with ``copy.deepcopy`` or ``pickle``, start with no variants.
+
+    Args:
+        model (torch.nn.Module or callable): the model or function to optimize.
+        max_variants (int, optional): the most optimized variants to keep.
+        tracer_class (type, optional): the tracer class to use to turn ``model`` into an ``fx.Graph`` if it isn't already an ``fx.GraphModule``.
+        background (bool, optional): whether to optimize on a background thread, serving with the unoptimized model meanwhile.
+        on_swap (callable, optional): if ``background``, called with the signature and the optimized variant each time one is swapped in.
+        **optimize_kwargs: other keyword arguments for ``optimize_einsums_full``.
+    """
+
+    def __init__(
+        self,
+        model: Union[torch.nn.Module, Callable],
+        max_variants: int = 8,
+        tracer_class: type = fx.Tracer,
+        background: bool = False,
+        on_swap: Optional[Callable[[Hashable, fx.GraphModule], None]] = None,
+        **optimize_kwargs: Any,
+    ):
+        super().__init__()
+        if max_variants < 1:
+            raise ValueError("max_variants must be at least 1")
+        if not isinstance(model, fx.GraphModule):
+            tracer: fx.Tracer = tracer_class()
+            graph = tracer.trace(model)
+            model = fx.GraphModule(tracer.root, graph)
+        self.module = model
+        self.max_variants = max_variants
+        self.background = background
+        self.on_swap = on_swap
+        self.optimize_kwargs = optimize_kwargs
+        self.num_swaps = 0
+        # Not submodules, so that the shared parameters aren't listed again for each variant
+        self._variants: "OrderedDict[Hashable, fx.GraphModule]" = OrderedDict()
+        # Guards the variants and the background optimizations
+        self._lock = threading.Lock()
+        self._pending: Dict[Hashable, threading.Thread] = {}
+        self._failed: Set[Hashable] = set()
+
+    def __getstate__(self) -> Dict[str, Any]:
+        # Locks and threads can't be copied or pickled, and the variants are optimized again on demand
+        with self._lock:
+            state = self.__dict__.copy()
+        del state["_lock"]
+        state["_variants"] = OrderedDict()
+        state["_pending"] = {}
+        state["_failed"] = set()
+        return state
+
+    def __setstate__(self, state: Dict[str, Any]) -> None:
+        super().__setstate__(state)
+        self._lock = threading.Lock()
+
+    def _insert(self, key: Hashable, variant: fx.GraphModule) -> None:
+        # Must hold the lock
+        self._variants[key] = variant
+        if len(self._variants) > self.max_variants:
+            self._variants.popitem(last=False)
+
+    def _optimize_in_background(self, key: Hashable, args: tuple) -> None:
+        try:
+            variant = optimize_einsums_full(self.module, args, **self.optimize_kwargs)
+        except Exception as e:
+            warnings.warn(
+                f"Could not optimize for inputs {key}: {e}; serving them unoptimized",
+                RuntimeWarning,
+            )
+            with self._lock:
+                self._failed.add(key)
+                del self._pending[key]
+            return
+        with self._lock:
+            self._insert(key, variant)
+            self.num_swaps += 1
+            del self._pending[key]
+        if self.on_swap is not None:
+            self.on_swap(key, variant)
+
+    def variant(self, *args) -> fx.GraphModule:
+        """Get the module that serves ``args``: its optimized variant, optimizing it if it isn't cached, or if ``background`` and it isn't ready yet, the unoptimized model."""
+        key = _signature(args)
+        with self._lock:
+            variant = self._variants.get(key, None)
+            if variant is not None:
+                self._variants.move_to_end(key)
+                return variant
+            if self.background:
+                if key not in self._pending and key not in self._failed:
+                    thread = threading.Thread(
+                        target=self._optimize_in_background,
+                        args=(key, _copy_args(args)),
+                        daemon=True,
+                    )
+                    self._pending[key] = thread
+                    thread.start()
+                return self.module
+        # Optimizing runs the graph several times, which mustn't change the caller's tensors
+        variant = optimize_einsums_full(
+            self.module, _copy_args(args), **self.optimize_kwargs
+        )
+        with self._lock:
+            self._insert(key, variant)
+        return variant
+
+    def wait(self) -> None:
+        """Wait for all background optimizations to finish."""
+        while True:
+            with self._lock:
+                threads = list(self._pending.values())
+            if len(threads) == 0:
+                return
+            for thread in threads:
+                thread.join()
+
+    def forward(self, *args):
+        return self.variant(*args)(*args)
@@ -1,14 +1,28 @@
+import functools
 import warnings
-from typing import Callable, Union
+from typing import Callable, Optional, Union
 
-import opt_einsum
 import torch
-from opt_einsum.contract import _core_contract
 from torch import fx
 
 from ._fuse import _EINSUM_FUNCS, fuse_einsums, fuse_scalars
+from ._factor import factor_einsums
+from ._dims import merge_einsum_dims, squeeze_einsum_dims
+from ._aten import normalize_aten_ops
+from ._cost import _contract_path, _get_contract_kwargs
 from ._shape_prop import ShapeProp
-from .fx_utils import get_shape
+from ._contract import _Tensor, _contiguous_stride, _emit_contraction
+from ._layout import _emit_layout_aware_step, assign_einsum_layouts
+from ._lower import _HAS_VECDOT, _emit_native_step
+from ._permute import fold_permutes
+from ._kron import factor_kronecker_operands
+from ._message import fuse_message_passing
+from ._codegen import compile_einsums
+from ._autograd import _fused_einsum, _grad_equations
+from ._paths import _choose_path, _choose_training_path
+from ._blocks import _get_block_diagonal
+from ._sparse import _get_sparse_constant
+from .fx_utils import get_dtype, get_requires_grad, get_shape, get_stride
 
 
 def optimize_einsums_full(
@@ -16,22 +30,39 @@ def optimize_einsums_full(
     example_inputs: tuple,
     contract_kwargs: dict = {},
     tracer_class: type = fx.Tracer,
+    layout_aware: bool = False,
+    codegen: bool = False,
+    training: bool = False,
+    memory_budget: Optional[int] = None,
+    fused_backward: bool = False,
 ) -> Union[fx.GraphModule, fx.Graph]:
     """Optimize einsums in ``model`` for ``example_inputs``.
 
-    All of the restrictions of ``torch.fx`` symbolic tracing apply.
+    All of the restrictions of ``torch.fx`` symbolic tracing apply. Graphs of ATen operators, such as those traced with ``make_fx`` or AOTAutograd, are first rewritten with ``normalize_aten_ops``, so that backward graphs can be optimized too.
 
-    Applies, in order, four optimizations:
+    Applies, in order, ten optimizations:
 
         1. Scalar accumulation --- use the multilinearity of einsum to collect all constant coefficients and divisors of operands and outputs
-        2. Fusing einsums --- gives greater flexibility to (3)
-        3. Optimized contraction with ``opt_einsum``.
-        4. Moving constant scalar coefficients through operations they commute with in order to place them on the smallest possible intermediate results
+        2. Factoring --- use the distributivity of einsum to turn sums of einsums that share operands into single einsums
+        3. Fusing einsums --- gives greater flexibility to (8); fusions that would make the optimal contraction more expensive are skipped
+        4. Fusing gathers of node features, einsums over edges, and scatters back to nodes, so that per-edge intermediates are only ever allocated a chunk at a time
+        5. Removing the broadcast (stride 0) dimensions that the graph creates with ``expand`` from einsum operands
+        6. Replacing constant operands that are Kronecker products with their factors
+        7. Merging indices that always occur together in an einsum, when it can be done without copies
+        8. Optimized contraction with ``opt_einsum``; if ``layout_aware``, the index order of intermediate results is first chosen jointly across the graph to avoid copies; if ``codegen``, small einsums are instead compiled into C++ operators
+        9. Removing permutations left over from (8) that compose, do nothing, or can be folded into einsum subscripts
+        10. Moving constant scalar coefficients through operations they commute with in order to place them on the smallest possible intermediate results
 
     Args:
         model (torch.nn.Module or callable or fx.Graph): the model, function, or ``fx.Graph`` to optimize.
         example_inputs (tuple): arguments to ``model`` whose shapes will determine the einsum optimizations.
+        contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
         tracer_class (type, optional): the tracer class to use to turn ``model`` into an ``fx.Graph`` if it isn't already an ``fx.GraphModule`` or ``fx.Graph``.
+        layout_aware (bool, optional): passed to ``optimize_einsums``.
+        codegen (bool, optional): whether to compile small einsums into C++ operators with ``compile_einsums``; the result can then only be used for inference, and only for the example shapes of the compiled einsums. Also passed to ``optimize_einsums``.
+        training (bool, optional): passed to ``optimize_einsums``.
+        memory_budget (int, optional): passed to ``optimize_einsums``.
+        fused_backward (bool, optional): passed to ``optimize_einsums``.
 
     Returns:
         An optimized ``fx.GraphModule``, or if ``model`` is an ``fx.Graph``, an optimized ``fx.Graph``.
@@ -48,30 +79,88 @@ def optimize_einsums_full(
         graph: fx.Graph = tracer.trace(model)
         model = tracer.root
 
+    # Turn ATen operators into the einsums and scalar operations the passes look for
+    graph = normalize_aten_ops(graph)
+
     # 1. Scalar accumulation
     # without shape information, this just accumulates scalars and moves them to the end of chains of linear operations
-    graph = fuse_scalars(graph)
+    graph = fuse_scalars(graph, in_place=True)
 
-    # 2. Fuse any einsums we can
+    # 2. Factor common operands out of sums of einsums
+    graph = factor_einsums(graph, in_place=True)
+
+    # 3. Shape propagation
+    # Fusion needs shapes to decide what is worth fusing
+    out_mod = fx.GraphModule(model, graph)
+    sp = ShapeProp(out_mod)
+    sp.run(*example_inputs)
+
+    # 4. Fuse any einsums we can
     # This gives opt_einsum the most freedom possible to rearange things
     # Since we already moved scalars to the end of chains of linear operations, any scalars between linear operations should already have been moved
-    graph = fuse_einsums(graph, in_place=True)
-    out_mod = fx.GraphModule(model, graph)
+    # Fusion doesn't change the shapes of any remaining nodes, so the shape information stays valid
+    out_mod.graph = fuse_einsums(
+        out_mod.graph,
+        in_place=True,
+        cost_aware=True,
+        contract_kwargs=contract_kwargs,
+    )
 
-    # 3. Shape propagation
+    # 5. Fuse message passing
+    # Einsums that are fused this way are no longer einsums, so this comes before anything that reshapes their operands
+    out_mod.graph = fuse_message_passing(
+        out_mod.graph, contract_kwargs, in_place=True
+    )
+
+    # 6. Remove broadcast dimensions from einsum operands
+    out_mod.graph = squeeze_einsum_dims(out_mod.graph, in_place=True)
     sp = ShapeProp(out_mod)
     sp.run(*example_inputs)
 
-    # 4. Optimize einsums
-    out_mod.graph = optimize_einsums(out_mod.graph, contract_kwargs)
+    # 7. Replace constants that are Kronecker products with their factors
+    out_mod.graph = factor_kronecker_operands(
+        out_mod.graph, contract_kwargs, in_place=True
+    )
+    # The factors and reshaped operands are new nodes, so they need shapes
+    sp = ShapeProp(out_mod)
+    sp.run(*example_inputs)
+
+    # 8. Merge indices that always occur together
+    # This gives opt_einsum fewer dimensions to deal with
+    out_mod.graph = merge_einsum_dims(out_mod.graph, in_place=True)
+    # The squeezed and merged operands are new nodes, so they need shapes
+    sp = ShapeProp(out_mod)
+    sp.run(*example_inputs)
+
+    # 9. Optimize einsums
+    if layout_aware:
+        # Choose the layouts of intermediates together, so that consumers don't have to copy them
+        # This keeps the shape information up to date
+        out_mod.graph = assign_einsum_layouts(
+            out_mod.graph, contract_kwargs, in_place=True
+        )
+    if codegen:
+        # Einsums that are compiled are no longer einsums, so optimize_einsums leaves them alone
+        out_mod.graph = compile_einsums(out_mod.graph, contract_kwargs, in_place=True)
+    out_mod.graph = optimize_einsums(
+        out_mod.graph,
+        contract_kwargs,
+        layout_aware=layout_aware,
+        training=training,
+        memory_budget=memory_budget,
+        fused_backward=fused_backward,
+        codegen=codegen,
+    )
+    # Clean up the permutations between contraction steps
+    out_mod.graph = fold_permutes(out_mod.graph, in_place=True)
     out_mod.recompile()
 
-    # 5. Shape prop (again)
+    # 10. Shape prop (again)
     # We need shapes to put the scalars in the best place
     sp = ShapeProp(out_mod)
     sp.run(*example_inputs)
 
-    # 6. Final scalar fusion to move scalars
+    # 11. Final scalar fusion to move scalars
     out_mod.graph = fuse_scalars(out_mod.graph, in_place=True)
 
     if output_graph:
@@ -81,34 +170,55 @@ def optimize_einsums_full(
         return out_mod
 
 
-# Based on "Proxy Retracing" example in https://pytorch.org/docs/stable/fx.html
-def optimize_einsums(graph: fx.Graph, contract_kwargs: dict = {}) -> fx.Graph:
+def optimize_einsums(
+    graph: fx.Graph,
+    contract_kwargs: dict = {},
+    layout_aware: bool = False,
+    training: bool = False,
+    memory_budget: Optional[int] = None,
+    fused_backward: bool = False,
+    codegen: bool = False,
+) -> fx.Graph:
     """Optimize einsums in a ``torch.fx.Graph`` using ``opt_einsum``.
 
     ``graph`` must have shape information such as that populated by ``torch.fx.passes.shape_prop.ShapeProp``. The shapes are used for ``opt_einsum`` and the result is specific to the number of dimensions in the provided shapes ``opt_einsum``:
 
         ...while it will work for a set of arrays with the same ranks as the original shapes but differing sizes, it might no longer be optimal.
 
-    See the ``opt_einsum`` `documentation <https://optimized-einsum.readthedocs.io/en/stable/reusing_paths.html>`_ for more details.
+    See the ``opt_einsum`` `documentation <https://optimized-einsum.readthedocs.io/en/stable/reusing_paths.html>`_ for more details. The same holds for every option below: the example shapes and strides decide how each einsum is computed, but the emitted operations take the sizes of their operands at runtime, and only the sizes of constant operands are fixed. The one exception is ``codegen``, whose kernels are compiled for the sizes of the matrices they multiply and raise an error for any others.
+
+    If ``layout_aware`` is true, pairwise contractions that are matrix multiplications are emitted directly as ``mm`` or ``bmm`` on views of their operands. The order in which indices are flattened follows each operand's actual strides, as recorded by ``ShapeProp`` for inputs and as known from the emitted operations for intermediates, so that no operand is copied into a different layout unless it has to be. Since the result of a matrix multiplication can be computed transposed for free, each intermediate's index order is chosen to suit the contraction that consumes it. The result is specific to the strides of the example inputs as well as their shapes.
+
+    Steps that ``torch.einsum`` handles poorly are lowered to native operations regardless: single-operand steps become ``diagonal`` and ``sum``, Hadamard and outer products become broadcasted multiplications, and dot products along shared indices become ``torch.linalg.vecdot`` (for real operands in PyTorch 2.0 or newer) or a multiplication and a ``sum``. If ``codegen`` is true, batched products of tiny matrices, like ``"zij,zj->zi"`` with a large ``z`` and small ``i`` and ``j``, whose operands don't need gradients, are computed by C++ kernels compiled with ``torch.utils.cpp_extension.load_inline`` for the matrices' sizes, instead of by ``bmm``, which spends most of its time on per-matrix overhead for them; the batch size is left to runtime. Contractions of an operand with itself into a symmetric matrix, like ``"ij,kj->ik"``, compute only the blocks on and above the diagonal; since this makes them cheaper, paths that contract such pairs first are also considered.
+
+    Constant operands --- buffers of the graph's owning module that are accessed with ``get_attr`` --- that are mostly zeros are contracted with ``torch.sparse.mm`` wherever a step multiplies them with another operand without batch indices. The sparse matrices are registered as new buffers of the owning module. Path costs for such steps are scaled by the constant's density, and paths that contract the constant first are also considered. This assumes the values of the buffers do not change after optimization. In the same way, block-diagonal matrices --- constant buffers found to be so, or parameters declared to be with ``annotate_block_diagonal`` --- are contracted block by block with a single ``bmm`` over views of their diagonal blocks, or with an ``mm`` per block if the blocks differ in size.
+
+    If ``training`` is true, paths are chosen for the time of the forward and backward passes together. The gradient of each operand of a step is another contraction about as expensive as the step, so contracting the operands that need gradients late is cheaper. Paths also differ in which intermediates autograd saves for the backward pass; if ``memory_budget`` is given, only paths whose saved intermediates take at most that many bytes per einsum are considered, or if there are none, the one that saves the least. Which operands need gradients is taken from the ``requires_grad`` recorded by ``ShapeProp``, so example inputs whose gradients will be needed should require them.
+
+    If ``fused_backward`` is true, einsums with an operand that requires grad are instead computed by a ``torch.autograd.Function``. Its forward contracts along the optimized path and saves only the operands, rather than autograd saving every intermediate of the emitted steps. Its backward computes the gradient of each operand as an einsum of the output's gradient and the other operands, contracted along a path optimized for it independently, so intermediates are recomputed only as they suit each gradient. The backward is itself differentiable. Einsums with structured operands, complex operands, or operands whose gradients aren't einsums --- because of repeated indices or indices that are summed within a single operand --- are emitted as usual. Graphs with such functions can't be compiled with TorchScript.
 
     Args:
         graph (fx.Graph): the graph to optimize
         contract_kwargs: extra keyword arguments for ``opt_einsum.contract_path``.
+        layout_aware (bool, optional): whether to take the memory layout of operands into account when emitting contractions.
+        training (bool, optional): whether to choose contraction paths for the cost of the backward pass as well as the forward pass.
+        memory_budget (int, optional): if ``training``, the most bytes of intermediates each einsum may save for the backward pass.
+        fused_backward (bool, optional): whether to compute einsums that need gradients with a ``torch.autograd.Function`` whose backward contracts each gradient along its own optimized path.
+        codegen (bool, optional): whether to compute batches of tiny matrix products with compiled C++ kernels; the result then only works for the example sizes of all but the batch indices of those products.
 
     Returns:
         An optimized ``fx.Graph``.
     """
-    defaults = {
-        "optimize": "optimal",
-    }
-    defaults.update(contract_kwargs)
-    contract_kwargs = defaults
+    contract_kwargs = _get_contract_kwargs(contract_kwargs)
 
     new_graph = fx.Graph()
-    tracer = fx.proxy.GraphAppendingTracer(new_graph)
     # env keeps track of new injected nodes in addition to existing ones,
     # making sure they get into new_graph
     env = {}
+    # the strides of the results of the einsums we've emitted, which ShapeProp doesn't know
+    strides = {}
+    # the operands whose zeros are worth skipping, or None
+    structured = {}
     node_processed: bool = False
     for node in graph.nodes:
         node_processed = False
@@ -126,34 +236,115 @@ def optimize_einsums(graph: fx.Graph, contract_kwargs: dict = {}) -> fx.Graph:
             else:
                 # We have shapes, so:
                 # Determine the optimal contraction
-                path, path_info = opt_einsum.contract_path(
+                path, path_info = _contract_path(
                     node.args[0],  # the einstr
-                    *shapes,
-                    shapes=True,
-                    **contract_kwargs,
+                    shapes,
+                    contract_kwargs,
+                )
+                for a in node.args[1:]:
+                    if a not in structured:
+                        structured[a] = _get_block_diagonal(a) or _get_sparse_constant(a)
+                densities = {
+                    a: structured[a].density
+                    for a in node.args[1:]
+                    if structured[a] is not None
+                }
+                if len(densities) > 0 or len(set(node.args[1:])) < len(node.args) - 1:
+                    # Products of an operand with itself or with a structured one are cheaper than opt_einsum thinks
+                    path_info = _choose_path(
+                        node.args[0],
+                        node.args[1:],
+                        shapes,
+                        path_info,
+                        contract_kwargs,
+                        densities,
+                    )
+                requires_grad = [get_requires_grad(a) for a in node.args[1:]]
+                dtypes = [get_dtype(a) for a in node.args[1:]]
+                input_subscripts = path_info.input_subscripts.split(",")
+                grad_equations = None
+                if (
+                    fused_backward
+                    and any(requires_grad)
+                    and len(densities) == 0
+                    and all(d is not None and not d.is_complex for d in dtypes)
+                ):
+                    grad_equations = _grad_equations(
+                        input_subscripts, path_info.output_subscript
+                    )
+                if grad_equations is not None:
+                    # The backward saves only the operands, so only the forward cost matters for the forward path
+                    out_shape = tuple(
+                        path_info.size_dict[lab] for lab in path_info.output_subscript
+                    )
+                    grad_paths = []
+                    for i, grad_equation in enumerate(grad_equations):
+                        grad_path, _ = _contract_path(
+                            grad_equation,
+                            [out_shape] + shapes[:i] + shapes[i + 1:],
+                            contract_kwargs,
+                        )
+                        grad_paths.append(tuple(tuple(step) for step in grad_path))
+                    env[node.name] = new_graph.call_function(
+                        _fused_einsum,
+                        (
+                            ",".join(input_subscripts)
+                            + "->"
+                            + path_info.output_subscript,
+                            tuple(tuple(c[0]) for c in path_info.contraction_list),
+                            tuple(grad_equations),
+                            tuple(grad_paths),
+                        )
+                        + tuple(env[a.name] for a in node.args[1:]),
+                    )
+                    continue
+                if training and any(requires_grad):
+                    # Gradients are contractions too, and the intermediates saved for them take memory
+                    budget = memory_budget
+                    if budget is not None and get_dtype(node) is not None:
+                        budget //= torch.empty((), dtype=get_dtype(node)).element_size()
+                    path_info = _choose_training_path(
+                        node.args[0],
+                        shapes,
+                        path_info,
+                        contract_kwargs,
+                        [bool(r) for r in requires_grad],
+                        budget,
+                    )
+                operands = []
+                for x, shape, labels in zip(node.args[1:], shapes, input_subscripts):
+                    shape = tuple(int(n) for n in shape)
+                    stride = strides.get(x.name, None) or get_stride(x)
+                    operands.append(
+                        _Tensor(
+                            node=env[x.name],
+                            labels=labels,
+                            shape=shape,
+                            stride=_contiguous_stride(shape)
+                            if stride is None
+                            else stride,
+                        )
+                    )
+                emit_step = functools.partial(
+                    _emit_native_step,
+                    fallback=_emit_layout_aware_step if layout_aware else None,
+                    vecdot=_HAS_VECDOT
+                    and all(d is not None and not d.is_complex for d in dtypes),
+                    structured={env[a.name]: structured[a] for a in densities},
+                    # The compiled kernels have no derivatives
+                    codegen_dtype=dtypes[0]
+                    if codegen and len(set(dtypes)) == 1 and not any(requires_grad)
+                    else None,
                 )
-                # By wrapping the arguments with proxies,
-                # we can dispatch to opt_einsum and implicitly
-                # add it to the Graph by symbolically tracing it.
-                proxy_args = [
-                    fx.Proxy(env[x.name], tracer=tracer) if isinstance(x, fx.Node) else x
-                    for x in node.args
-                ]
-                # Use _core_contract to avoid `len()` calls that
-                # fx can't deal with
-                output_proxy = _core_contract(
-                    proxy_args[1:],
+                out = _emit_contraction(
+                    new_graph,
+                    operands,
                     path_info.contraction_list,
-                    backend="torch",
-                    evaluate_constants=False,
+                    path_info.output_subscript,
+                    emit_step=emit_step,
                 )
-
-                # Operations on `Proxy` always yield new `Proxy`s, and the
-                # return value of our decomposition rule is no exception.
-                # We need to extract the underlying `Node` from the `Proxy`
-                # to use it in subsequent iterations of this transform.
-                new_node = output_proxy.node
-                env[node.name] = new_node
+                env[node.name] = out.node
+                strides[node.name] = out.stride
                 node_processed = True
 
         if not node_processed:
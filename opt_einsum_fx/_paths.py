@@ -0,0 +1,173 @@
+from typing import Any, Dict, List, Optional, Sequence, Tuple
+
+import opt_einsum
+from opt_einsum.helpers import flop_count
+
+from ._cost import _contract_path
+from ._fuse import prod
+from ._symmetric import _SYMMETRIC_DISCOUNT, _SYMMETRIC_MIN_SIZE, _gram_labels
+from ._sparse import _sparse_labels
+
+
+def _discounted_cost(
+    path_info, args: Sequence[Any], densities: Dict[Any, float] = {}
+) -> float:
+    """The cost of a contraction path, discounting the steps that will be computed as symmetric or sparse products.
+
+    Args:
+        path_info: the ``PathInfo`` of the path.
+        args: the operands; identical operands are the same object.
+        densities: the fraction of nonzeros in those of ``args`` that will be treated as sparse.
+    """
+    ids: List[Any] = list(args)
+    size_dict = path_info.size_dict
+    cost = 0.0
+    for inds, idx_rm, einsum_str, _, _ in path_info.contraction_list:
+        popped = [ids.pop(x) for x in inds]
+        input_str, results_index = einsum_str.split("->")
+        inputs = input_str.split(",")
+        step_cost = flop_count(
+            set(input_str) - {","}, bool(idx_rm), len(inds), size_dict
+        )
+        if len(popped) == 2 and popped[0] is not None and popped[0] is popped[1]:
+            roles = _gram_labels(inputs[0], inputs[1], results_index)
+            if (
+                roles is not None
+                and prod(size_dict[lab] for lab in roles.left) >= _SYMMETRIC_MIN_SIZE
+            ):
+                step_cost *= _SYMMETRIC_DISCOUNT
+        elif len(popped) == 2:
+            for k in (0, 1):
+                if popped[k] in densities and (
+                    _sparse_labels(inputs[k], inputs[1 - k], results_index) is not None
+                ):
+                    step_cost *= densities[popped[k]]
+                    break
+        cost += step_cost
+        ids.append(None)
+    return cost
+
+
+def _path_contracting_first(
+    einstr: str, shapes: Sequence, path_info, i: int, j: int, contract_kwargs: dict
+):
+    """Get the ``PathInfo`` of the best path that starts by contracting operands ``i`` and ``j``."""
+    inputs = path_info.input_subscripts.split(",")
+    output = path_info.output_subscript
+    others = [k for k in range(len(inputs)) if k not in (i, j)]
+    # The pair's result keeps whatever is still needed
+    needed = output + "".join(inputs[k] for k in others)
+    result = "".join(lab for lab in inputs[i] + inputs[j] if lab in needed)
+    result = "".join(lab for n, lab in enumerate(result) if lab not in result[:n])
+    rest_path, _ = _contract_path(
+        ",".join([inputs[k] for k in others] + [result]) + "->" + output,
+        [shapes[k] for k in others] + [tuple(path_info.size_dict[lab] for lab in result)],
+        contract_kwargs,
+    )
+    _, candidate = opt_einsum.contract_path(
+        einstr, *shapes, shapes=True, optimize=[(i, j)] + list(rest_path)
+    )
+    return candidate
+
+
+def _choose_path(
+    einstr: str,
+    args: Sequence[Any],
+    shapes: Sequence,
+    path_info,
+    contract_kwargs: dict,
+    densities: Dict[Any, float] = {},
+):
+    """Find a contraction path that takes the discounts for symmetric and sparse products into account.
+
+    ``opt_einsum`` can't be told about these discounts, so for every pair of operands that are the same or that include a sparse operand, the best path that contracts them first is considered along with the path in ``path_info``.
+
+    Returns:
+        The ``PathInfo`` of the cheapest path.
+    """
+    best, best_cost = path_info, _discounted_cost(path_info, args, densities)
+    if len(args) <= 2:
+        return best
+    for i in range(len(args)):
+        for j in range(i + 1, len(args)):
+            if args[i] is not args[j] and not (
+                args[i] in densities or args[j] in densities
+            ):
+                continue
+            candidate = _path_contracting_first(
+                einstr, shapes, path_info, i, j, contract_kwargs
+            )
+            cost = _discounted_cost(candidate, args, densities)
+            if cost < best_cost:
+                best, best_cost = candidate, cost
+    return best
+
+
+def _training_cost(path_info, requires_grad: Sequence[bool]) -> Tuple[float, int]:
+    """Estimate the forward plus backward cost of a contraction path, and the number of elements of intermediates that autograd saves for the backward pass.
+
+    The gradient of each operand of a step is a contraction over the same indices as the step, so costs about as much as the step itself. Autograd saves an operand of a step whenever another operand of the step needs a gradient; the inputs are kept alive anyway, so only the intermediates are counted.
+
+    Args:
+        path_info: the ``PathInfo`` of the path.
+        requires_grad: whether each operand needs a gradient.
+    """
+    size_dict = path_info.size_dict
+    needs = list(requires_grad)
+    intermediate = [False] * len(needs)
+    cost = 0.0
+    saved = 0
+    for inds, idx_rm, einsum_str, _, _ in path_info.contraction_list:
+        popped_needs = [needs.pop(x) for x in inds]
+        popped_intermediate = [intermediate.pop(x) for x in inds]
+        input_str, _ = einsum_str.split("->")
+        inputs = input_str.split(",")
+        step_cost = flop_count(
+            set(input_str) - {","}, bool(idx_rm), len(inds), size_dict
+        )
+        cost += step_cost * (1 + sum(popped_needs))
+        for k, labels in enumerate(inputs):
+            if popped_intermediate[k] and any(
+                popped_needs[m] for m in range(len(inputs)) if m != k
+            ):
+                saved += prod(size_dict[lab] for lab in labels)
+        needs.append(any(popped_needs))
+        intermediate.append(True)
+    return cost, saved
+
+
+def _choose_training_path(
+    einstr: str,
+    shapes: Sequence,
+    path_info,
+    contract_kwargs: dict,
+    requires_grad: Sequence[bool],
+    memory_budget: Optional[int] = None,
+):
+    """Find a contraction path that minimizes the estimated forward plus backward cost, among those that save at most ``memory_budget`` elements of intermediates for the backward pass.
+
+    The candidates are the path in ``path_info`` and, for every pair of operands, the best path that contracts them first. If no candidate fits in the budget, the one that saves the least is chosen.
+
+    Returns:
+        The ``PathInfo`` of the chosen path.
+    """
+    candidates = [path_info]
+    n = len(shapes)
+    if n > 2:
+        for i in range(n):
+            for j in range(i + 1, n):
+                candidates.append(
+                    _path_contracting_first(
+                        einstr, shapes, path_info, i, j, contract_kwargs
+                    )
+                )
+    costs = [_training_cost(c, requires_grad) for c in candidates]
+    fits = [
+        k for k, (_, saved) in enumerate(costs)
+        if memory_budget is None or saved <= memory_budget
+    ]
+    if len(fits) > 0:
+        best = min(fits, key=lambda k: costs[k][0])
+    else:
+        best = min(range(len(candidates)), key=lambda k: (costs[k][1], costs[k][0]))
+    return candidates[best]
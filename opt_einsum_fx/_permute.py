@@ -0,0 +1,146 @@
+from typing import Optional, Tuple
+import copy
+
+import torch
+from torch import fx
+
+from ._fuse import _get_einstrs, _is_einsum
+from .fx_utils import get_shape
+
+
+def _get_permutation(node: fx.Node) -> Optional[Tuple[fx.Node, Tuple[int, ...]]]:
+    """Get the input of a permutation of dimensions and the permutation, with non-negative dims."""
+    if not isinstance(node, fx.Node):
+        return None
+    if node.op == "call_method" and node.target == "permute" and len(node.kwargs) == 0:
+        # TODO: this could _technically_ be wrong if the nodes `self` argument is not a (proxy to) a Tensor
+        dims = node.args[1:]
+        if len(dims) == 1 and isinstance(dims[0], (tuple, list)):
+            dims = dims[0]
+        x = node.args[0]
+    elif (
+        node.op == "call_function"
+        and node.target is getattr(torch, "permute", None)
+        and len(node.args) == 2
+        and len(node.kwargs) == 0
+    ):
+        x, dims = node.args
+    elif node.op == "call_method" and node.target in ("t", "transpose"):
+        x = node.args[0]
+        shape = get_shape(x) if isinstance(x, fx.Node) else None
+        if shape is None or len(node.kwargs) > 0:
+            return None
+        ndim = len(shape)
+        if node.target == "t":
+            if len(node.args) != 1 or ndim > 2:
+                return None
+            d0, d1 = (0, 1) if ndim == 2 else (0, 0)
+        else:
+            if len(node.args) != 3:
+                return None
+            d0, d1 = node.args[1:]
+        dims = list(range(ndim))
+        if ndim > 0:
+            dims[d0], dims[d1] = dims[d1], dims[d0]
+    else:
+        return None
+    if not isinstance(x, fx.Node) or not all(isinstance(d, int) for d in dims):
+        return None
+    dims = tuple(d % len(dims) for d in dims)
+    if sorted(dims) != list(range(len(dims))):
+        return None
+    return x, dims
+
+
+def _replace_node(graph: fx.Graph, old: fx.Node, new: fx.Node) -> None:
+    old.replace_all_uses_with(new)
+    graph.erase_node(old)
+
+
+def fold_permutes(graph: fx.Graph, in_place: bool = False) -> fx.Graph:
+    """Remove redundant permutations of dimensions.
+
+    Contracting an einsum pairwise can leave behind ``permute`` operations that undo each other or only relabel dimensions for another einsum. This pass:
+
+        1. composes consecutive permutations into one;
+        2. removes identity permutations;
+        3. folds permutations of einsum inputs into the einsum's subscripts;
+        4. folds permutations of einsum outputs into the einsum's subscripts, if the einsum has no other users.
+
+    ``permute`` is recognized as a method or function; ``t`` and ``transpose`` are also recognized for inputs with shape information, such as that populated by ``ShapeProp``. The shape information of einsums whose outputs are reordered is not updated.
+
+    Args:
+        graph: the graph to process.
+        in_place (bool, optional): whether to process ``graph`` in place.
+
+    Returns:
+        The graph with folded permutations.
+    """
+    if not in_place:
+        graph = copy.deepcopy(graph)
+
+    # Each fold can expose another, so repeat until nothing changes
+    changed = True
+    while changed:
+        changed = False
+        for node in list(graph.nodes):
+            permutation = _get_permutation(node)
+            if permutation is None:
+                continue
+            x, dims = permutation
+
+            if dims == tuple(range(len(dims))):
+                # 2. Identity
+                _replace_node(graph, node, x)
+                changed = True
+                continue
+
+            inner = _get_permutation(x)
+            if inner is not None and len(inner[1]) == len(dims):
+                # 1. Compose
+                x, inner_dims = inner
+                with graph.inserting_before(node):
+                    new_node = graph.call_method(
+                        "permute", (x,) + tuple(inner_dims[d] for d in dims)
+                    )
+                _replace_node(graph, node, new_node)
+                changed = True
+                continue
+
+            if _is_einsum(x) and len(x.users) == 1 and "..." not in x.args[0]:
+                # 4. Fold into the output of the einsum that makes it
+                inp_einstrs, out_einstr = _get_einstrs(x.args[0])
+                if len(out_einstr) == len(dims):
+                    x.args = (
+                        ",".join(inp_einstrs)
+                        + "->"
+                        + "".join(out_einstr[d] for d in dims),
+                    ) + tuple(x.args[1:])
+                    _replace_node(graph, node, x)
+                    changed = True
+                    continue
+
+            # 3. Fold into einsums that use it
+            for user in list(node.users):
+                if not _is_einsum(user) or "..." in user.args[0]:
+                    continue
+                inp_einstrs, out_einstr = _get_einstrs(user.args[0])
+                new_args = list(user.args[1:])
+                for i, arg in enumerate(new_args):
+                    if arg is not node or len(inp_einstrs[i]) != len(dims):
+                        continue
+                    # Dimension d of the permuted tensor is dimension dims[d] of x
+                    labels = [None] * len(dims)
+                    for d, lab in zip(dims, inp_einstrs[i]):
+                        labels[d] = lab
+                    inp_einstrs[i] = "".join(labels)
+                    new_args[i] = x
+                    changed = True
+                user.args = (",".join(inp_einstrs) + "->" + out_einstr,) + tuple(
+                    new_args
+                )
+            if len(node.users) == 0:
+                graph.erase_node(node)
+
+    graph.lint()
+    return graph
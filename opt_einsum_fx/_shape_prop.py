@@ -77,6 +77,11 @@ def _extract_tensor_metadata(result: torch.Tensor) -> TensorMetadata:
         shape, dtype, requires_grad, stride, memory_format, is_quantized, qscheme, q_scale, q_zero_point)
 
 
+def _requires_grad(operands) -> bool:
+    # The stand-in results must need gradients whenever the real ones would
+    return torch.is_grad_enabled() and any(isinstance(x, torch.Tensor) and x.requires_grad for x in operands)
+
+
 class ShapeProp(torch.fx.Interpreter):
     def run_node(self, n: Node) -> Any:
         if n.op == 'call_function' and n.target == torch.einsum:
@@ -85,14 +90,14 @@ class ShapeProp(torch.fx.Interpreter):
             subscripts = args[0]
             shapes = [x.shape for x in args[1:]]
             shape = einsum_shape(subscripts, *shapes)
-            result = torch.empty(shape, dtype=args[1].dtype)
+            result = torch.empty(shape, dtype=args[1].dtype, requires_grad=_requires_grad(args[1:]))
         elif n.op == 'call_function' and n.target == torch.tensordot:
             args, kwargs = self.fetch_args_kwargs_from_env(n)
             shape_a, shape_b = [x.shape for x in args]
             inds_a, inds_b = kwargs['dims']
             shape_a = [n for i, n in enumerate(shape_a) if i not in inds_a]
             shape_b = [n for i, n in enumerate(shape_b) if i not in inds_b]
-            result = torch.empty(shape_a + shape_b, dtype=args[0].dtype)
+            result = torch.empty(shape_a + shape_b, dtype=args[0].dtype, requires_grad=_requires_grad(args))
         else:
             result = super().run_node(n)
 
@@ -0,0 +1,149 @@
+from typing import Any, Dict, NamedTuple, Optional, Sequence, Tuple
+
+import torch
+from torch import fx
+
+from ._contract import _Tensor, _contiguous_stride, _permute_tensor
+from ._fuse import prod
+
+# Constant operands with at most this fraction of nonzeros are contracted as sparse matrices
+_SPARSE_MAX_DENSITY: float = 0.1
+
+
+def _fetch_attr(module: torch.nn.Module, target: str):
+    obj = module
+    for atom in target.split("."):
+        if not hasattr(obj, atom):
+            return None
+        obj = getattr(obj, atom)
+    return obj
+
+
+class _SparseConstant:
+    """A mostly-zero constant operand, and the sparse matrices made from it so far."""
+
+    def __init__(self, value: torch.Tensor, owner: torch.nn.Module, target: str):
+        self.value = value
+        self.owner = owner
+        self.target = target
+        self.density = float(torch.count_nonzero(value)) / max(value.numel(), 1)
+        self._buffers: Dict[Tuple[int, ...], str] = {}
+
+    def supports(self, roles) -> bool:
+        return True
+
+    def matmul(self, graph: fx.Graph, s: _Tensor, roles, x: fx.Node) -> fx.Node:
+        order = tuple(s.labels.index(lab) for lab in roles.left + roles.contracted)
+        n_rows = prod(s.shape[s.labels.index(lab)] for lab in roles.left)
+        return graph.call_function(
+            torch.sparse.mm, (self._matrix(graph, order, n_rows), x)
+        )
+
+    def _matrix(self, graph: fx.Graph, order: Tuple[int, ...], n_rows: int) -> fx.Node:
+        """Get a node for the constant with its dimensions in ``order``, flattened into a sparse matrix with ``n_rows`` rows."""
+        if order not in self._buffers:
+            mat = self.value.permute(order).reshape(n_rows, -1).to_sparse().coalesce()
+            base = "_sparse_" + self.target.replace(".", "_")
+            name = base
+            i = 0
+            while hasattr(self.owner, name):
+                i += 1
+                name = f"{base}_{i}"
+            self.owner.register_buffer(name, mat)
+            self._buffers[order] = name
+        return graph.get_attr(self._buffers[order])
+
+
+def _get_sparse_constant(node: fx.Node) -> Optional[_SparseConstant]:
+    """If ``node`` is a mostly-zero constant, get it."""
+    if not isinstance(node, fx.Node) or node.op != "get_attr":
+        return None
+    owner = getattr(node.graph, "owning_module", None)
+    if owner is None:
+        return None
+    value = _fetch_attr(owner, node.target)
+    if (
+        not isinstance(value, torch.Tensor)
+        or isinstance(value, torch.nn.Parameter)
+        or value.layout != torch.strided
+        or value.dim() < 2
+        or value.requires_grad
+    ):
+        # Parameters can change, so aren't constant
+        return None
+    constant = _SparseConstant(value, owner, node.target)
+    if constant.density > _SPARSE_MAX_DENSITY:
+        return None
+    return constant
+
+
+class _SparseLabels(NamedTuple):
+    left: str
+    contracted: str
+    right: str
+
+
+def _sparse_labels(s: str, x: str, keep: str) -> Optional[_SparseLabels]:
+    """If a sparse operand labeled ``s`` and a dense one labeled ``x`` can be contracted into ``keep`` as a sparse-dense matrix product, get the roles of their indices."""
+    if len(set(s)) != len(s) or len(set(x)) != len(x):
+        return None
+    left, contracted = "", ""
+    for lab in s:
+        if lab in x and lab not in keep:
+            contracted += lab
+        elif lab not in x and lab in keep:
+            left += lab
+        else:
+            # Batch indices, or indices that would have to be summed out first
+            return None
+    right = "".join(lab for lab in x if lab not in s)
+    if len(contracted) == 0 or not all(lab in keep for lab in right):
+        return None
+    return _SparseLabels(left, contracted, right)
+
+
+def _emit_structured(
+    graph: fx.Graph,
+    operands: Sequence[_Tensor],
+    results_index: str,
+    structured: Dict[fx.Node, Any],
+) -> Optional[_Tensor]:
+    """Emit a step that contracts a structured operand with a dense one as a matrix product, if it is one.
+
+    The values of ``structured`` are objects with a ``density`` --- the fraction of the operand that has to be multiplied --- a method ``supports(roles)``, and a method ``matmul(graph, s, roles, x)`` that emits the product of the structured operand ``s``, seen as a matrix with the roles ``roles``, and the matrix ``x``.
+    """
+    if len(operands) != 2:
+        return None
+    for s, x in (operands, reversed(operands)):
+        if s.node not in structured:
+            continue
+        roles = _sparse_labels(s.labels, x.labels, results_index)
+        if roles is None or not structured[s.node].supports(roles):
+            continue
+        sizes = dict(zip(s.labels + x.labels, s.shape + x.shape))
+        x = _permute_tensor(graph, x, roles.contracted + roles.right)
+        # Only the dense operand's free indices can change size between calls; the structured operand's are fixed
+        xm = x.node
+        if len(roles.contracted) != 1 or len(roles.right) != 1:
+            xm = graph.call_method(
+                "reshape", (xm, (prod(sizes[lab] for lab in roles.contracted), -1))
+            )
+        out = structured[s.node].matmul(graph, s, roles, xm)
+        labels = roles.left + roles.right
+        shape = tuple(sizes[lab] for lab in labels)
+        if len(roles.left) != 1 or len(roles.right) != 1:
+            out = graph.call_method(
+                "reshape",
+                (
+                    out,
+                    tuple(sizes[lab] for lab in roles.left)
+                    + tuple(
+                        graph.call_method("size", (x.node, len(roles.contracted) + k))
+                        for k in range(len(roles.right))
+                    ),
+                ),
+            )
+        return _Tensor(
+            node=out, labels=labels, shape=shape, stride=_contiguous_stride(shape)
+        )
+    return None
@@ -0,0 +1,100 @@
+from typing import NamedTuple, Optional, Sequence
+
+import torch
+from torch import fx
+
+from ._contract import _Tensor, _contiguous_stride, _permute_tensor
+from ._fuse import prod
+
+# The number of row blocks the symmetric product is split into
+_SYMMETRIC_BLOCKS: int = 4
+# Below this many rows, the extra matrix multiplications aren't worth it
+_SYMMETRIC_MIN_SIZE: int = 128
+# Only the blocks on and above the diagonal are computed
+_SYMMETRIC_DISCOUNT: float = (1 + 1 / _SYMMETRIC_BLOCKS) / 2
+
+
+def _symmetric_mm(x: torch.Tensor, blocks: int) -> torch.Tensor:
+    """Compute ``x @ x.transpose(-1, -2)`` for a (batch of) ``n x k`` matrices ``x``, computing only the blocks on and above the diagonal and mirroring them."""
+    n = x.shape[-2]
+    block = (n + blocks - 1) // blocks
+    out = x.new_empty(list(x.shape[:-2]) + [n, n])
+    for i in range(0, n, block):
+        rows = min(block, n - i)
+        # One row of blocks, from the diagonal on
+        upper = torch.matmul(
+            x.narrow(-2, i, rows), x.narrow(-2, i, n - i).transpose(-1, -2)
+        )
+        out.narrow(-2, i, rows).narrow(-1, i, n - i).copy_(upper)
+        out.narrow(-2, i, n - i).narrow(-1, i, rows).copy_(upper.transpose(-1, -2))
+    return out
+
+
+class _GramLabels(NamedTuple):
+    batch: str
+    left: str
+    right: str
+    contracted: str
+
+
+def _gram_labels(a: str, b: str, keep: str) -> Optional[_GramLabels]:
+    """If the same tensor labeled ``a`` and ``b`` is contracted with itself into ``keep`` as a Gram matrix, get the roles of its indices."""
+    if len(a) != len(b) or len(set(a)) != len(a) or len(set(b)) != len(b):
+        return None
+    batch, left, right, contracted = "", "", "", ""
+    for lab_a, lab_b in zip(a, b):
+        if lab_a == lab_b:
+            if lab_a in keep:
+                batch += lab_a
+            else:
+                contracted += lab_a
+        elif lab_a not in b and lab_b not in a and lab_a in keep and lab_b in keep:
+            left += lab_a
+            right += lab_b
+        else:
+            return None
+    if len(left) == 0 or len(contracted) == 0:
+        return None
+    return _GramLabels(batch, left, right, contracted)
+
+
+def _emit_gram(
+    graph: fx.Graph, operands: Sequence[_Tensor], results_index: str
+) -> Optional[_Tensor]:
+    """Emit a step that contracts a tensor with itself into a symmetric matrix, if it is one, with ``_symmetric_mm``."""
+    if len(operands) != 2:
+        return None
+    a, b = operands
+    if a.node is not b.node or a.shape != b.shape or a.stride != b.stride:
+        return None
+    roles = _gram_labels(a.labels, b.labels, results_index)
+    if roles is None:
+        return None
+    sizes = dict(zip(a.labels, a.shape))
+    n = prod(sizes[lab] for lab in roles.left)
+    if n < _SYMMETRIC_MIN_SIZE:
+        return None
+    x = _permute_tensor(graph, a, roles.batch + roles.left + roles.contracted).node
+    # Flatten each group of indices, going backwards so that the earlier groups' numbering doesn't change; sizes are only known at runtime
+    xm = x
+    start = len(roles.batch) + len(roles.left) + len(roles.contracted)
+    for group in (roles.contracted, roles.left, roles.batch):
+        start -= len(group)
+        if len(group) > 1:
+            xm = graph.call_method("flatten", (xm, start, start + len(group) - 1))
+    out = graph.call_function(_symmetric_mm, (xm, _SYMMETRIC_BLOCKS))
+    labels = roles.batch + roles.left + roles.right
+    if results_index == roles.batch + roles.right + roles.left:
+        # The result is symmetric, so it can be read either way around
+        labels = results_index
+    shape = tuple(sizes[lab] for lab in roles.batch + roles.left + roles.left)
+    if len(roles.batch) > 1 or len(roles.left) > 1:
+        dims = list(range(len(roles.batch) + len(roles.left))) + [
+            len(roles.batch) + d for d in range(len(roles.left))
+        ]
+        out = graph.call_method(
+            "reshape", (out, tuple(graph.call_method("size", (x, d)) for d in dims))
+        )
+    return _Tensor(
+        node=out, labels=labels, shape=shape, stride=_contiguous_stride(shape)
+    )
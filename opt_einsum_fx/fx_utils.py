@@ -1,4 +1,4 @@
-from typing import Optional
+from typing import Optional, Tuple
 from packaging import version
 
 import torch
@@ -26,3 +26,27 @@ else:
             return n.shape
         except AttributeError:
             return None
+
+
+def get_stride(n: fx.Node) -> Optional[Tuple[int, ...]]:
+    """Get the strides of a node after ``ShapeProp``, if they were recorded"""
+    try:
+        return tuple(n.meta["tensor_meta"].stride)
+    except (KeyError, AttributeError):
+        return None
+
+
+def get_dtype(n: fx.Node) -> Optional[torch.dtype]:
+    """Get the dtype of a node after ``ShapeProp``, if it was recorded"""
+    try:
+        return n.meta["tensor_meta"].dtype
+    except (KeyError, AttributeError):
+        return None
+
+
+def get_requires_grad(n: fx.Node) -> Optional[bool]:
+    """Get whether a node requires grad after ``ShapeProp``, if it was recorded"""
+    try:
+        return n.meta["tensor_meta"].requires_grad
+    except (KeyError, AttributeError):
+        return None
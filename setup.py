@@ -25,4 +25,9 @@ setuptools.setup(
     python_requires=">=3.6",
     install_requires=["torch>=1.8.0", "opt_einsum", "packaging"],
     packages=["opt_einsum_fx"],
+    entry_points={
+        "torch_dynamo_backends": [
+            "opt_einsum_fx = opt_einsum_fx:opt_einsum_backend",
+        ],
+    },
 )
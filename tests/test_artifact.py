@@ -0,0 +1,101 @@
+import pytest
+
+import torch
+
+import opt_einsum_fx._artifact
+from opt_einsum_fx import load_optimized, optimize_einsums_full, save_optimized
+from opt_einsum_fx._artifact import _bind_state, _tensor_digest, _trace
+
+
+class Model(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(4, 5))
+        self.register_buffer("mask", torch.randn(5, 6))
+
+    def forward(self, x):
+        return torch.einsum("zi,ij,jk->zk", x, self.weight, self.mask)
+
+
+class Sliced(torch.nn.Module):
+    """A model whose traced graph is the same whatever the shape of its weight."""
+
+    def __init__(self, hidden):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(4, hidden))
+        self.register_buffer("mask", torch.arange(48.0).reshape(8, 6))
+
+    def forward(self, x):
+        return torch.einsum("zi,ij,jk->zk", x, self.weight, self.mask[: self.weight.shape[1]])
+
+
+def _no_optimization(*args, **kwargs):
+    raise AssertionError("optimized again")
+
+
+def test_artifact(allclose, tmp_path, monkeypatch):
+    path = str(tmp_path / "model.pt")
+    model = Model()
+    x = torch.randn(3, 4)
+    optimized = load_optimized(path, model, (x,))
+    assert allclose(optimized(x), model(x))
+
+    monkeypatch.setattr(
+        opt_einsum_fx._artifact, "optimize_einsums_full", _no_optimization
+    )
+    loaded = load_optimized(path, model, (x,))
+    assert allclose(loaded(x), model(x))
+    # The loaded module shares the model's parameters
+    with torch.no_grad():
+        model.weight.mul_(2.0)
+    assert allclose(loaded(x), model(x))
+
+
+@pytest.mark.parametrize("change", ["shape", "buffer", "options"])
+def test_artifact_mismatch(allclose, tmp_path, monkeypatch, change):
+    calls = []
+
+    def counting(*args, **kwargs):
+        calls.append(None)
+        return optimize_einsums_full(*args, **kwargs)
+
+    monkeypatch.setattr(opt_einsum_fx._artifact, "optimize_einsums_full", counting)
+    path = str(tmp_path / "model.pt")
+    model = Model()
+    x = torch.randn(3, 4)
+    save_optimized(path, optimize_einsums_full(model, (x,)), model, (x,))
+    kwargs = {}
+    if change == "shape":
+        x = torch.randn(7, 4)
+    elif change == "buffer":
+        model.mask.fill_(1.0)
+    else:
+        kwargs = {"layout_aware": True}
+    optimized = load_optimized(path, model, (x,), **kwargs)
+    assert len(calls) == 1
+    assert allclose(optimized(x), model(x))
+
+
+def test_artifact_parameter_shape(allclose, tmp_path):
+    path = str(tmp_path / "model.pt")
+    x = torch.randn(3, 4)
+    load_optimized(path, Sliced(5), (x,))
+    model = Sliced(3)
+    optimized = load_optimized(path, model, (x,))
+    assert allclose(optimized(x), model(x))
+
+
+def test_bind_state_mismatch():
+    x = torch.randn(3, 4)
+    optimized = optimize_einsums_full(Sliced(5), (x,))
+    with pytest.raises(ValueError):
+        _bind_state(optimized, _trace(Sliced(3), torch.fx.Tracer))
+
+
+@pytest.mark.parametrize("dtype", [torch.float32, torch.float64, torch.bfloat16, torch.int64, torch.bool])
+def test_tensor_digest(dtype):
+    t = torch.arange(6).reshape(2, 3).to(dtype)
+    assert _tensor_digest(t) == _tensor_digest(t.clone())
+    assert _tensor_digest(t) == _tensor_digest(t.t().contiguous().t())
+    assert _tensor_digest(t) != _tensor_digest(t.reshape(3, 2))
+    assert _tensor_digest(t) != _tensor_digest(torch.zeros_like(t))
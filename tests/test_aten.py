@@ -0,0 +1,52 @@
+import pytest
+
+import torch
+import torch.fx
+
+from opt_einsum_fx import normalize_aten_ops, optimize_einsums_full
+
+make_fx = pytest.importorskip("torch.fx.experimental.proxy_tensor").make_fx
+
+
+def _targets(graph):
+    return [node.target for node in graph.nodes if node.op == "call_function"]
+
+
+def test_normalize_aten_ops(allclose):
+    def f(x, y, z):
+        return 2.0 * torch.mm(torch.bmm(x, y).sum(0), z.t())
+
+    x, y, z = torch.randn(3, 4, 5), torch.randn(3, 5, 6), torch.randn(2, 6)
+    gm = make_fx(f)(x, y, z)
+    graph = normalize_aten_ops(gm.graph)
+    targets = _targets(graph)
+    assert targets.count(torch.einsum) == 4
+    assert all(t in (torch.einsum,) or t.__module__ == "_operator" for t in targets)
+    g = optimize_einsums_full(gm, (x, y, z))
+    assert allclose(g(x, y, z), f(x, y, z))
+
+
+def test_forces(allclose):
+    weight = torch.randn(4, 4, 5)
+
+    def energy(pos):
+        return torch.einsum("ai,bj,ijk,ck->", pos, pos, weight, pos)
+
+    def forces(pos):
+        pos = pos.detach().requires_grad_(True)
+        (grad,) = torch.autograd.grad(energy(pos), pos, create_graph=True)
+        return -grad
+
+    pos = torch.randn(6, 4)
+    gm = make_fx(forces)(pos)
+    g = optimize_einsums_full(gm, (pos,))
+    assert allclose(g(pos), forces(pos))
+
+
+def test_sum_without_dims():
+    graph = torch.fx.Graph()
+    x = graph.placeholder("x")
+    x.meta["val"] = torch.empty(3, 4)
+    graph.output(graph.call_function(torch.ops.aten.sum.dim_IntList, (x, None)))
+    # A sum over unspecified dimensions is left alone rather than guessed at
+    assert torch.einsum not in _targets(normalize_aten_ops(graph))
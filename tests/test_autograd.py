@@ -0,0 +1,73 @@
+import pytest
+
+import torch
+
+from opt_einsum_fx import optimize_einsums_full
+from opt_einsum_fx._autograd import _fused_einsum
+
+
+class Bilinear(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(6, 7, 8))
+
+    def forward(self, x, y):
+        return torch.einsum("zi,zj,ijk->zk", x, y, self.weight)
+
+
+def _targets(graph):
+    return [node.target for node in graph.nodes if node.op == "call_function"]
+
+
+@pytest.mark.parametrize("x_requires_grad", [False, True])
+def test_fused_backward(allclose, x_requires_grad):
+    model = Bilinear()
+    x = torch.randn(20, 6, requires_grad=x_requires_grad)
+    y = torch.randn(20, 7)
+    g = optimize_einsums_full(model, (x, y), fused_backward=True)
+    assert _fused_einsum in _targets(g.graph)
+
+    out = g(x, y)
+    true_out = model(x, y)
+    assert allclose(out, true_out)
+    inputs = [model.weight] + ([x] if x_requires_grad else [])
+    grads = torch.autograd.grad(out.square().sum(), inputs)
+    true_grads = torch.autograd.grad(true_out.square().sum(), inputs)
+    for grad, true_grad in zip(grads, true_grads):
+        assert allclose(grad, true_grad)
+
+
+def test_fused_backward_no_grad():
+    def func(x, y):
+        return torch.einsum("ij,jk->ik", x, y)
+
+    x, y = torch.randn(3, 4), torch.randn(4, 5)
+    g = optimize_einsums_full(func, (x, y), fused_backward=True)
+    # Nothing needs a gradient, so there's nothing to fuse
+    assert _fused_einsum not in _targets(g.graph)
+
+
+def test_fused_backward_intermediate(allclose):
+    def func(x, w, v):
+        h = torch.einsum("ij,jk->ik", x, w).tanh()
+        return torch.einsum("ik,kl,lm->im", h, v, v)
+
+    x = torch.randn(3, 4, requires_grad=True)
+    w, v = torch.randn(4, 5), torch.randn(5, 5)
+    g = optimize_einsums_full(func, (x, w, v), fused_backward=True)
+    # The second einsum only needs a gradient through the result of the first
+    assert _targets(g.graph).count(_fused_einsum) == 2
+    (grad,) = torch.autograd.grad(g(x, w, v).sum(), x)
+    (true_grad,) = torch.autograd.grad(func(x, w, v).sum(), x)
+    assert allclose(grad, true_grad)
+
+
+def test_fused_backward_double():
+    def func(x, w):
+        return torch.einsum("ij,jk,kl->il", x, w, w)
+
+    x = torch.randn(3, 4, dtype=torch.float64, requires_grad=True)
+    w = torch.randn(4, 4, dtype=torch.float64, requires_grad=True)
+    g = optimize_einsums_full(func, (x, w), fused_backward=True)
+    assert _fused_einsum in _targets(g.graph)
+    assert torch.autograd.gradgradcheck(g, (x, w))
@@ -0,0 +1,61 @@
+import pytest
+
+import torch
+import torch.fx
+
+from opt_einsum_fx import annotate_block_diagonal, optimize_einsums_full, jitable
+
+
+class BlockLinear(torch.nn.Module):
+    def __init__(self, blocks, parameter: bool):
+        super().__init__()
+        weight = torch.block_diag(*[torch.randn(r, c) for r, c in blocks])
+        if parameter:
+            self.weight = torch.nn.Parameter(weight)
+            annotate_block_diagonal(
+                self.weight, [r for r, _ in blocks], [c for _, c in blocks]
+            )
+        else:
+            self.register_buffer("weight", weight)
+
+    def forward(self, x):
+        return torch.einsum("ij,zj->zi", self.weight, x)
+
+
+def _targets(graph):
+    return [node.target for node in graph.nodes if node.op == "call_function"]
+
+
+@pytest.mark.parametrize("parameter", [False, True])
+@pytest.mark.parametrize("blocks", [[(4, 3)] * 3, [(2, 3), (4, 1), (1, 5)]])
+def test_block_diagonal(allclose, blocks, parameter):
+    model = BlockLinear(blocks, parameter)
+    x = torch.randn(10, sum(c for _, c in blocks))
+    g = optimize_einsums_full(model, (x,))
+    targets = _targets(g.graph)
+    assert (torch.bmm in targets) == (len(set(blocks)) == 1)
+    assert torch.einsum not in targets
+    assert allclose(g(x), model(x))
+    g_script = torch.jit.script(jitable(g))
+    assert allclose(g_script(x), model(x))
+    # The batch dimension isn't fixed by the example
+    x = torch.randn(11, x.shape[1])
+    assert allclose(g(x), model(x))
+    assert allclose(g_script(x), model(x))
+
+
+def test_block_diagonal_grad(allclose):
+    model = BlockLinear([(4, 3)] * 3, parameter=True)
+    x = torch.randn(10, 9)
+    g = optimize_einsums_full(model, (x,))
+    g(x).sum().backward()
+    grad = g.weight.grad
+    g.weight.grad = None
+    model(x).sum().backward()
+    mask = torch.block_diag(*[torch.ones(4, 3)] * 3)
+    assert allclose(grad, model.weight.grad * mask)
+
+
+def test_bad_annotation():
+    with pytest.raises(ValueError):
+        annotate_block_diagonal(torch.randn(5, 5), [2, 2], [2, 2])
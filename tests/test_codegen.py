@@ -0,0 +1,123 @@
+import shutil
+
+import pytest
+
+import torch
+import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
+
+from opt_einsum_fx import compile_einsums, optimize_einsums_full, jitable
+
+
+def _can_compile() -> bool:
+    try:
+        from torch.utils.cpp_extension import verify_ninja_availability
+
+        verify_ninja_availability()
+    except (ImportError, RuntimeError):
+        return False
+    return shutil.which("c++") is not None
+
+
+needs_compiler = pytest.mark.skipif(not _can_compile(), reason="no C++ toolchain")
+
+
+def chain(x, y, z):
+    return torch.einsum("ij,jk,k->i", x, y, z)
+
+
+def trace(x, y, z):
+    return torch.einsum("ii,jk,k->j", x, y, z)
+
+
+def _einsums(graph):
+    return [
+        node
+        for node in graph.nodes
+        if node.op == "call_function"
+        and node.target in (torch.einsum, torch.functional.einsum)
+    ]
+
+
+@needs_compiler
+@pytest.mark.parametrize("func", [chain, trace])
+@pytest.mark.parametrize("dtype", [torch.float32, torch.float64])
+def test_compile_einsums(allclose, func, dtype):
+    x, y, z = torch.randn(4, 4), torch.randn(4, 5), torch.randn(5)
+    x, y, z = x.to(dtype), y.to(dtype), z.to(dtype)
+    g = optimize_einsums_full(func, (x, y, z), codegen=True)
+    assert len(_einsums(g.graph)) == 0
+    assert allclose(g(x, y, z), func(x, y, z))
+    # Non-contiguous operands are fine too
+    y = y.t().contiguous().t()
+    assert allclose(g(x, y, z), func(x, y, z))
+    g_script = torch.jit.script(jitable(g))
+    assert allclose(g_script(x, y, z), func(x, y, z))
+    with pytest.raises(RuntimeError):
+        g(x, torch.randn(4, 6, dtype=dtype), torch.randn(6, dtype=dtype))
+
+
+@needs_compiler
+def test_compile_einsums_too_big():
+    x, y, z = torch.randn(4, 4), torch.randn(4, 5), torch.randn(5)
+    g = torch.fx.symbolic_trace(chain)
+    ShapeProp(g).run(x, y, z)
+    graph = compile_einsums(g.graph, max_flops=10)
+    assert len(_einsums(graph)) == 1
+
+
+def test_compile_einsums_int():
+    # Only floating point einsums are compiled, so this doesn't need a compiler
+    x, y, z = torch.ones(4, 4, dtype=torch.long), torch.ones(4, 5, dtype=torch.long), torch.ones(5, dtype=torch.long)
+    g = torch.fx.symbolic_trace(chain)
+    ShapeProp(g).run(x, y, z)
+    graph = compile_einsums(g.graph)
+    assert len(_einsums(graph)) == 1
+
+
+def test_compile_einsums_broadcast():
+    # Operands that broadcast are skipped before anything is compiled, so this doesn't need a compiler
+    x, y, z = torch.randn(3, 4), torch.randn(1, 5), torch.randn(5)
+    g = torch.fx.symbolic_trace(chain)
+    ShapeProp(g).run(x, y, z)
+    graph = compile_einsums(g.graph)
+    assert len(_einsums(graph)) == 1
+
+
+def _uses_compiled(graph):
+    return any(
+        node.op == "call_function" and "opt_einsum_fx_" in str(node.target)
+        for node in graph.nodes
+    )
+
+
+def matvec(a, x):
+    return torch.einsum("zij,zj->zi", a, x)
+
+
+def matmul(a, b):
+    return torch.einsum("zij,zjk->zik", a, b)
+
+
+@needs_compiler
+@pytest.mark.parametrize(
+    "func,shapes", [(matvec, ((3, 4), (4,))), (matmul, ((2, 3), (3, 2)))]
+)
+def test_tiny_matmul(allclose, func, shapes):
+    # Too big for compile_einsums, which would fix the batch size
+    args = tuple(torch.randn((5000,) + shape) for shape in shapes)
+    g = optimize_einsums_full(func, args, codegen=True)
+    targets = [node.target for node in g.graph.nodes if node.op == "call_function"]
+    assert not any(t in targets for t in (torch.einsum, torch.functional.einsum, torch.bmm))
+    assert _uses_compiled(g.graph)
+    assert allclose(g(*args), func(*args))
+    # Only the matrices' sizes are compiled in
+    args = tuple(torch.randn((3001,) + shape) for shape in shapes)
+    assert allclose(g(*args), func(*args))
+
+
+def test_tiny_matmul_no_codegen(allclose):
+    args = (torch.randn(5000, 3, 4), torch.randn(5000, 4))
+    g = optimize_einsums_full(matvec, args)
+    assert not _uses_compiled(g.graph)
+    assert allclose(g(*args), matvec(*args))
@@ -0,0 +1,153 @@
+import pytest
+
+import torch
+import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
+
+from opt_einsum_fx import merge_einsum_dims, optimize_einsums_full, squeeze_einsum_dims
+
+
+def _einstrs(graph):
+    return [
+        node.args[0]
+        for node in graph.nodes
+        if node.op == "call_function"
+        and node.target in (torch.einsum, torch.functional.einsum)
+    ]
+
+
+def mergeable(x, y):
+    return torch.einsum("abc,bcd->ad", x, y)
+
+
+def mergeable_out(x, y):
+    return torch.einsum("zabc,bcd->zad", x, y)
+
+
+@pytest.mark.parametrize(
+    "func,shapes,truth_einstr",
+    [
+        (mergeable, ((2, 3, 4), (3, 4, 5)), "ab,bd->ad"),
+        (mergeable_out, ((6, 2, 3, 4), (3, 4, 5)), "zb,bd->zd"),
+    ],
+)
+def test_merge_dims(allclose, func, shapes, truth_einstr):
+    args = tuple(torch.randn(shape) for shape in shapes)
+    g = torch.fx.symbolic_trace(func)
+    ShapeProp(g).run(*args)
+    g.graph = merge_einsum_dims(g.graph)
+    g.recompile()
+    assert _einstrs(g.graph) == [truth_einstr]
+    assert allclose(g(*args), func(*args))
+    # Only the ranks are baked in
+    args = tuple(torch.randn(tuple(n + 1 for n in shape)) for shape in shapes)
+    assert allclose(g(*args), func(*args))
+
+
+def test_merge_dims_output(allclose):
+    def f(x, y):
+        return torch.einsum("ij,ijk->ijk", x, y)
+
+    x, y = torch.randn(3, 4), torch.randn(3, 4, 5)
+    g = torch.fx.symbolic_trace(f)
+    ShapeProp(g).run(x, y)
+    g.graph = merge_einsum_dims(g.graph)
+    g.recompile()
+    assert _einstrs(g.graph) == ["i,ik->ik"]
+    out = g(x, y)
+    assert out.shape == (3, 4, 5)
+    assert allclose(out, f(x, y))
+    x, y = torch.randn(2, 6), torch.randn(2, 6, 7)
+    assert allclose(g(x, y), f(x, y))
+
+
+def test_no_merge_strides():
+    x = torch.randn(2, 3, 4)
+    # The b and c dimensions of y can't be viewed as one
+    y = torch.randn(4, 3, 5).transpose(0, 1)
+    g = torch.fx.symbolic_trace(mergeable)
+    ShapeProp(g).run(x, y)
+    g.graph = merge_einsum_dims(g.graph)
+    assert _einstrs(g.graph) == ["abc,bcd->ad"]
+
+
+def test_no_merge_without_shapes():
+    g = torch.fx.symbolic_trace(mergeable)
+    g.graph = merge_einsum_dims(g.graph)
+    assert _einstrs(g.graph) == ["abc,bcd->ad"]
+
+
+def test_merge_full(allclose):
+    x, y = torch.randn(2, 3, 4), torch.randn(3, 4, 5)
+    g = optimize_einsums_full(mergeable, (x, y))
+    assert allclose(g(x, y), mergeable(x, y))
+
+
+def expanded(x, y):
+    return torch.einsum("ij,ij->i", x, y.expand(3, 4))
+
+
+def expanded_sum(x, y):
+    return torch.einsum("ij,j->", y.unsqueeze(0).expand(5, 4), y)
+
+
+def expanded_out(x, y):
+    return torch.einsum("ij->ij", y.expand(3, 4))
+
+
+@pytest.mark.parametrize(
+    "func,truth_einstr",
+    [
+        (expanded, "ij,j->i"),
+        (expanded_sum, "j,j->"),
+        (expanded_out, "j->j"),
+    ],
+)
+def test_squeeze_dims(allclose, func, truth_einstr):
+    x, y = torch.randn(3, 4), torch.randn(4)
+    g = torch.fx.symbolic_trace(func)
+    ShapeProp(g).run(x, y)
+    g.graph = squeeze_einsum_dims(g.graph)
+    g.recompile()
+    assert _einstrs(g.graph) == [truth_einstr]
+    out = g(x, y)
+    assert out.shape == func(x, y).shape
+    assert allclose(out, func(x, y))
+    # The output is fresh memory, like the einsum's
+    out.add_(1.0)
+
+
+def test_no_squeeze_inputs(allclose):
+    def f(x, y):
+        return torch.einsum("zi,zi->i", x, y)
+
+    # Only the example is broadcast; inputs with the same shapes needn't be
+    x, y = torch.randn(4).expand(3, 4), torch.randn(3, 4)
+    g = torch.fx.symbolic_trace(f)
+    ShapeProp(g).run(x, y)
+    g.graph = squeeze_einsum_dims(g.graph)
+    g.recompile()
+    assert _einstrs(g.graph) == ["zi,zi->i"]
+    x = torch.randn(3, 4)
+    assert allclose(g(x, y), f(x, y))
+
+
+def test_no_squeeze_expanded_inputs(allclose):
+    def f(x, y):
+        return torch.einsum("zi,zi->z", x.expand_as(y), y)
+
+    # x's second dimension is only broadcast because the example's has size 1
+    x, y = torch.randn(3, 1), torch.randn(3, 4)
+    g = torch.fx.symbolic_trace(f)
+    ShapeProp(g).run(x, y)
+    g.graph = squeeze_einsum_dims(g.graph)
+    g.recompile()
+    assert _einstrs(g.graph) == ["zi,zi->z"]
+    x = torch.randn(3, 4)
+    assert allclose(g(x, y), f(x, y))
+
+
+def test_squeeze_full(allclose):
+    x, y = torch.randn(3, 4), torch.randn(4)
+    g = optimize_einsums_full(expanded_sum, (x, y))
+    assert allclose(g(x, y), expanded_sum(x, y))
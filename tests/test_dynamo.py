@@ -0,0 +1,51 @@
+import pytest
+
+import torch
+
+from opt_einsum_fx import opt_einsum_backend
+
+pytestmark = pytest.mark.skipif(
+    not hasattr(torch, "compile"), reason="torch.compile requires PyTorch 2.0"
+)
+
+
+def einmatvecmul(a, b, vec):
+    return 2.0 * torch.einsum("zij,zjk,zk->zi", a, b, vec)
+
+
+def test_backend(allclose):
+    compiled = []
+
+    def backend(gm, example_inputs):
+        out = opt_einsum_backend(gm, example_inputs)
+        compiled.append(out)
+        return out
+
+    torch._dynamo.reset()
+    f = torch.compile(einmatvecmul, backend=backend, dynamic=False)
+    for z in (7, 11):
+        a, b, vec = torch.randn(z, 4, 5), torch.randn(z, 5, 3), torch.randn(z, 3)
+        assert allclose(f(a, b, vec), einmatvecmul(a, b, vec))
+    # Every shape gets its own optimized graph
+    assert len(compiled) == 2
+    for gm in compiled:
+        # The three-operand einsum was broken up along its optimal path
+        assert all(
+            len(node.args) <= 3
+            for node in gm.graph.nodes
+            if node.op == "call_function"
+            and node.target in (torch.einsum, torch.functional.einsum)
+        )
+
+
+def test_backend_leaves_inputs(allclose):
+    def f(x, y):
+        x.mul_(2.0)
+        return torch.einsum("ij,jk->ik", x, y)
+
+    x, y = torch.randn(3, 4), torch.randn(4, 5)
+    x_before = x.clone()
+    gm = opt_einsum_backend(torch.fx.symbolic_trace(f), [x, y])
+    # Optimizing runs the graph, but not on the example inputs themselves
+    assert torch.equal(x, x_before)
+    assert allclose(gm(x, y), f(x_before.clone(), y))
@@ -1,10 +1,17 @@
 import pytest
 
+import opt_einsum
 import torch
 import torch.fx
 from torch.fx.passes.shape_prop import ShapeProp
 
-from opt_einsum_fx import optimize_einsums, optimize_einsums_full, jitable
+from opt_einsum_fx import (
+    assign_einsum_layouts,
+    optimize_einsums,
+    optimize_einsums_full,
+    jitable,
+)
+from opt_einsum_fx._paths import _choose_training_path
 
 
 def einmatmul(x, y):
@@ -96,6 +103,167 @@ def test_optimize_einsums_full(einfunc, allclose):
     assert allclose(func_res, func_opt(x, y))
 
 
+def test_optimize_einsums_layout_aware(einfunc, allclose):
+    x = torch.randn(3, 4)
+    y = torch.randn(5, 4).t()
+    func_res = einfunc(x, y)
+    func_opt = optimize_einsums_full(einfunc, (x, y), layout_aware=True)
+    assert allclose(func_res, func_opt(x, y))
+    # The same graph still works for other layouts, if not as fast
+    y = y.contiguous()
+    assert allclose(func_res, func_opt(x, y))
+    # ... and other sizes
+    x, y = torch.randn(2, 4), torch.randn(4, 6)
+    assert allclose(einfunc(x, y), func_opt(x, y))
+
+
+def test_layout_aware_no_copies(allclose):
+    def batched(a, b, vec):
+        return torch.einsum("zij,zjk,zk->zi", a, b, vec)
+
+    a, b, vec = torch.randn(7, 4, 5), torch.randn(7, 3, 5).transpose(1, 2), torch.randn(7, 3)
+    g = optimize_einsums_full(batched, (a, b, vec), layout_aware=True)
+    targets = [node.target for node in g.graph.nodes if node.op in ("call_function", "call_method")]
+    assert targets.count(torch.bmm) == 2
+
+    def storage(t):
+        return getattr(t, "untyped_storage", t.storage)().data_ptr()
+
+    class CheckViews(torch.fx.Interpreter):
+        """Check that every matrix multiplication is of views of the inputs or of earlier products."""
+
+        def __init__(self, module):
+            super().__init__(module)
+            self.storages = set()
+
+        def placeholder(self, target, args, kwargs):
+            out = super().placeholder(target, args, kwargs)
+            self.storages.add(storage(out))
+            return out
+
+        def call_function(self, target, args, kwargs):
+            if target in (torch.bmm, torch.mm):
+                assert all(storage(t) in self.storages for t in args)
+            out = super().call_function(target, args, kwargs)
+            if target in (torch.bmm, torch.mm):
+                self.storages.add(storage(out))
+            return out
+
+    assert allclose(CheckViews(g).run(a, b, vec), batched(a, b, vec))
+
+
+def test_assign_einsum_layouts(allclose):
+    def chain(a, b, w):
+        p = torch.einsum("zij,zjk->zik", a, b)
+        return torch.einsum("zik,zk->i", p, w)
+
+    a, b, w = torch.randn(5, 3, 4), torch.randn(5, 4, 6), torch.randn(5, 6)
+    g = torch.fx.symbolic_trace(chain)
+    ShapeProp(g).run(a, b, w)
+    g.graph = assign_einsum_layouts(g.graph)
+    einstrs = [
+        node.args[0]
+        for node in g.graph.nodes
+        if node.op == "call_function"
+        and node.target in (torch.einsum, torch.functional.einsum)
+    ]
+    # z and k have to be flattened together for the second contraction, so they can't be split by i
+    assert einstrs[0].split("->")[1] in ("izk", "zki")
+    g.recompile()
+    assert allclose(g(a, b, w), chain(a, b, w))
+    # The recorded shapes were kept up to date
+    g.graph = optimize_einsums(g.graph, layout_aware=True)
+    g.recompile()
+    assert allclose(g(a, b, w), chain(a, b, w))
+
+
+def test_native_lowering(allclose):
+    def batch_dot(x, y):
+        return torch.einsum("zi,zi->z", x, y)
+
+    def outer(x, y):
+        return torch.einsum("zi,zj->zij", x, y)
+
+    x, y = torch.randn(3, 5), torch.randn(3, 5)
+    for func in (eintrace, batch_dot, outer):
+        g = optimize_einsums_full(func, (x, y))
+        targets = [
+            node.target
+            for node in g.graph.nodes
+            if node.op in ("call_function", "call_method")
+        ]
+        assert not any(
+            t in targets
+            for t in (torch.einsum, torch.functional.einsum, torch.bmm, torch.tensordot)
+        )
+        assert allclose(g(x, y), func(x, y))
+    x = x.to(torch.complex64)
+    y = y.to(torch.complex64)
+    g = optimize_einsums_full(batch_dot, (x, y))
+    # vecdot would conjugate x
+    assert allclose(g(x, y), batch_dot(x, y))
+
+
+def gram(x, a):
+    return torch.einsum("ij,kj->ik", x, x) + a
+
+
+def gram_trace(x, a):
+    # It's cheapest to contract x with itself first only because that product is symmetric
+    return torch.einsum("ai,bi,ab->", x, x, a)
+
+
+@pytest.mark.parametrize("func", [gram, gram_trace])
+def test_symmetric(allclose, func):
+    x, a = torch.randn(150, 40), torch.randn(150, 150)
+    g = optimize_einsums_full(func, (x, a))
+    targets = [node.target for node in g.graph.nodes if node.op == "call_function"]
+    assert any(getattr(t, "__name__", None) == "_symmetric_mm" for t in targets)
+    assert allclose(g(x, a), func(x, a))
+    g_script = torch.jit.script(jitable(g))
+    assert allclose(g_script(x, a), func(x, a))
+    # Neither the number of rows nor the number of columns is fixed by the example
+    x, a = torch.randn(170, 30), torch.randn(170, 170)
+    assert allclose(g(x, a), func(x, a))
+    assert allclose(g_script(x, a), func(x, a))
+
+
+@pytest.mark.parametrize("memory_budget", [None, 0])
+def test_training(allclose, memory_budget):
+    def chain(x, a, b):
+        return torch.einsum("ab,bc,cd->ad", x, a, b)
+
+    x = torch.randn(8, 300, requires_grad=True)
+    a, b = torch.randn(300, 300), torch.randn(300, 4)
+    g = optimize_einsums_full(
+        chain, (x, a, b), training=True, memory_budget=memory_budget
+    )
+    out = g(x, a, b)
+    assert allclose(out, chain(x, a, b))
+    (grad,) = torch.autograd.grad(out.sum(), x)
+    (true_grad,) = torch.autograd.grad(chain(x, a, b).sum(), x)
+    assert allclose(grad, true_grad)
+
+
+@pytest.mark.parametrize(
+    "shapes,memory_budget,forward_path,training_path",
+    [
+        # Contracting the operand that needs a gradient last halves the backward pass
+        ([(2, 100), (100, 50), (50, 2)], None, [(0, 1), (0, 1)], [(1, 2), (0, 1)]),
+        # ... but then the (8, 4) intermediate is saved for it, which a budget of 0 rules out
+        ([(8, 300), (300, 300), (300, 4)], 0, [(1, 2), (0, 1)], [(0, 1), (0, 1)]),
+    ],
+)
+def test_training_path(shapes, memory_budget, forward_path, training_path):
+    contract_kwargs = {"optimize": "optimal"}
+    _, path_info = opt_einsum.contract_path("ab,bc,cd->ad", *shapes, shapes=True, **contract_kwargs)
+    assert path_info.path == forward_path
+    chosen = _choose_training_path(
+        "ab,bc,cd->ad", shapes, path_info, contract_kwargs, [True, False, False], memory_budget
+    )
+    assert chosen.path == training_path
+
+
 def test_fallback():
     # We only bother to test this for one function
     einfunc = fusable
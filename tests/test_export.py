@@ -0,0 +1,112 @@
+import os
+import shutil
+
+import pytest
+
+import torch
+import torch.fx
+
+from opt_einsum_fx import export_cpp, optimize_einsums_full
+
+
+def _can_compile() -> bool:
+    try:
+        from torch.utils.cpp_extension import verify_ninja_availability
+
+        verify_ninja_availability()
+    except (ImportError, RuntimeError):
+        return False
+    return shutil.which("c++") is not None
+
+
+needs_compiler = pytest.mark.skipif(not _can_compile(), reason="no C++ toolchain")
+
+
+class Chain(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(5, 6))
+
+    def forward(self, x, y):
+        return torch.einsum("zij,zjk,kl->zil", x, y, self.weight) * 2.0
+
+
+def test_export_cpp(tmp_path):
+    model = Chain()
+    x, y = torch.randn(7, 3, 4), torch.randn(7, 4, 5)
+    g = optimize_einsums_full(model, (x, y))
+    export_cpp(g, str(tmp_path), name="Chain")
+    assert sorted(os.listdir(tmp_path)) == [
+        "CMakeLists.txt",
+        "Chain.cpp",
+        "Chain.h",
+        "Chain_constants.pt",
+    ]
+    source = (tmp_path / "Chain.cpp").read_text()
+    # The optimized path is kept, rather than an einsum
+    assert "torch::einsum" not in source
+    assert "torch::bmm" in source or "torch::tensordot" in source
+    assert "torch::Tensor Chain::forward(const torch::Tensor& v_x, const torch::Tensor& v_y) const" in source
+    assert "add_library(Chain Chain.cpp)" in (tmp_path / "CMakeLists.txt").read_text()
+    constants = torch.load(tmp_path / "Chain_constants.pt")
+    assert list(constants.keys()) == ["weight"]
+    assert torch.equal(constants["weight"], model.weight.detach())
+
+
+class MessagePassing(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.w1 = torch.nn.Parameter(torch.randn(3, 4))
+        self.w2 = torch.nn.Parameter(torch.randn(4, 5))
+
+    def forward(self, x, edge_src, edge_dst):
+        messages = torch.einsum("ei,ij,jk->ek", x[edge_src], self.w1, self.w2)
+        return x.new_zeros(x.shape[0], 5).index_add(0, edge_dst, messages)
+
+
+def _build(directory, name: str, n_inputs: int):
+    """Build the class ``name`` exported to ``directory`` together with a function ``run`` that constructs it and calls ``forward``."""
+    from torch.utils.cpp_extension import load_inline
+
+    params = ", ".join(f"const torch::Tensor& x{i}" for i in range(n_inputs))
+    args = ", ".join(f"x{i}" for i in range(n_inputs))
+    runner = f"""
+torch::Tensor run(const std::string& constants_path, {params}) {{
+  return {name}(constants_path).forward({args});
+}}
+"""
+    with open(os.path.join(directory, f"{name}.cpp")) as f:
+        source = f.read()
+    return load_inline(
+        name=f"opt_einsum_fx_test_export_{name}_{torch.get_default_dtype()}".replace(".", "_"),
+        cpp_sources=[source + runner],
+        functions=["run"],
+        extra_include_paths=[str(directory)],
+    )
+
+
+@needs_compiler
+@pytest.mark.parametrize("model_class", [Chain, MessagePassing])
+def test_export_cpp_build(allclose, tmp_path, model_class):
+    model = model_class()
+    if model_class is Chain:
+        inputs = (torch.randn(7, 3, 4), torch.randn(7, 4, 5))
+    else:
+        inputs = (torch.randn(6, 3), torch.randint(6, (40,)), torch.randint(6, (40,)))
+    g = optimize_einsums_full(model, inputs)
+    name = model_class.__name__
+    export_cpp(g, str(tmp_path), name=name)
+    module = _build(tmp_path, name, len(inputs))
+    out = module.run(str(tmp_path / f"{name}_constants.pt"), *inputs)
+    assert allclose(out, model(*inputs))
+
+
+def test_export_cpp_unsupported(tmp_path):
+    def f(x):
+        return x[1:3]
+
+    g = torch.fx.symbolic_trace(f)
+    with pytest.raises(NotImplementedError):
+        export_cpp(g, str(tmp_path))
+    with pytest.raises(ValueError):
+        export_cpp(g, str(tmp_path), name="not a name")
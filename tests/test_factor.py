@@ -0,0 +1,80 @@
+import pytest
+
+import torch
+import torch.fx
+
+from opt_einsum_fx import factor_einsums, optimize_einsums_full
+
+
+def _count_einsums(graph):
+    return sum(
+        node.op == "call_function" and node.target in (torch.einsum, torch.functional.einsum)
+        for node in graph.nodes
+    )
+
+
+def matvec_sum(A, x, y, z):
+    return torch.einsum("ij,j->i", A, x) + torch.einsum("ij,j->i", A, y)
+
+
+def relabeled_diff(A, x, y, z):
+    # same roles, different labels and operand order
+    return torch.einsum("ij,j->i", A, x) - torch.einsum("b,ab->a", y, A)
+
+
+def triple_sum(A, x, y, z):
+    return (
+        torch.einsum("ij,j->i", A, x)
+        + torch.einsum("ij,j->i", A, y)
+        + torch.einsum("ij,j->i", A, z)
+    )
+
+
+def two_shared(A, x, y, z):
+    return torch.einsum("ij,j,i->", A, x, z) + torch.einsum("ij,j,i->", A, y, z)
+
+
+@pytest.mark.parametrize(
+    "func",
+    [
+        (matvec_sum, 1),
+        (relabeled_diff, 1),
+        (triple_sum, 1),
+        (two_shared, 1),
+    ],
+)
+def test_factor(allclose, func):
+    func, truth_num_einsums = func
+    g = torch.fx.symbolic_trace(func)
+    g.graph = factor_einsums(g.graph)
+    g.recompile()
+    assert _count_einsums(g.graph) == truth_num_einsums
+    A, x, y, z = torch.randn(4, 5), torch.randn(5), torch.randn(5), torch.randn(5)
+    if func is two_shared:
+        z = torch.randn(4)
+    assert allclose(g(A, x, y, z), func(A, x, y, z))
+
+
+def not_factorable(A, x, y, z):
+    # A plays a different role in each term
+    return torch.einsum("ij,j->i", A, x) + torch.einsum("ji,j->i", A, y)
+
+
+def used_elsewhere(A, x, y, z):
+    a = torch.einsum("ij,j->i", A, x)
+    return a + torch.einsum("ij,j->i", A, y), a
+
+
+@pytest.mark.parametrize("func", [not_factorable, used_elsewhere])
+def test_not_factorable(func):
+    g = torch.fx.symbolic_trace(func)
+    old_code = g.code
+    g.graph = factor_einsums(g.graph)
+    g.recompile()
+    assert old_code == g.code
+
+
+def test_factor_full(allclose):
+    A, x, y, z = torch.randn(5, 5), torch.randn(5), torch.randn(5), torch.randn(5)
+    g = optimize_einsums_full(triple_sum, (A, x, y, z))
+    assert allclose(g(A, x, y, z), triple_sum(A, x, y, z))
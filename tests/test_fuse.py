@@ -5,6 +5,7 @@ import operator
 
 import torch
 import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
 
 from opt_einsum_fx import fuse_einsums, fuse_scalars, optimize_einsums_full
 
@@ -79,6 +80,62 @@ def test_inconsistent():
         _ = fuse_einsums(g.graph)
 
 
+def _count_einsums(graph):
+    return sum(
+        node.op == "call_function" and node.target in (torch.einsum, torch.functional.einsum)
+        for node in graph.nodes
+    )
+
+
+def test_shared_fuse(allclose):
+    def shared(a, b, v, w):
+        # z is large and expensive; v and w are better contracted against a and b separately
+        z = torch.einsum("ij,jk->ik", a, b)
+        return torch.einsum("ik,k->i", z, v), torch.einsum("ik,i->k", z, w)
+
+    a, b, v, w = torch.randn(100, 2), torch.randn(2, 100), torch.randn(100), torch.randn(100)
+    g = torch.fx.symbolic_trace(shared)
+    # Without shapes or without cost awareness, nothing changes
+    assert _count_einsums(fuse_einsums(g.graph, cost_aware=True)) == 3
+    ShapeProp(g).run(a, b, v, w)
+    assert _count_einsums(fuse_einsums(g.graph)) == 3
+    g.graph = fuse_einsums(g.graph, cost_aware=True)
+    g.recompile()
+    assert _count_einsums(g.graph) == 2
+    for out_fused, out_truth in zip(g(a, b, v, w), shared(a, b, v, w)):
+        assert allclose(out_fused, out_truth)
+
+
+def test_shared_no_fuse():
+    def shared(a, b, c, d):
+        # Here duplicating z's matmul costs more than keeping it
+        z = torch.einsum("ij,jk->ik", a, b)
+        return torch.einsum("ik,kl->il", z, c), torch.einsum("ik,kl->il", z, d)
+
+    a, b, c, d = (torch.randn(10, 10) for _ in range(4))
+    g = torch.fx.symbolic_trace(shared)
+    ShapeProp(g).run(a, b, c, d)
+    assert _count_einsums(fuse_einsums(g.graph, cost_aware=True)) == 3
+
+
+def test_cost_aware_fuse(allclose):
+    def f(a, b, c, d):
+        e = torch.einsum("ij,jk->ik", a, b)
+        return torch.einsum("ik,kl,lm->im", e, c, d)
+
+    a, b, c, d = torch.randn(3, 100), torch.randn(100, 100), torch.randn(100, 100), torch.randn(100, 100)
+    g = torch.fx.symbolic_trace(f)
+    ShapeProp(g).run(a, b, c, d)
+    # With the greedy optimizer, the fused einsum gets a much worse path than the two separate ones
+    contract_kwargs = {"optimize": "greedy"}
+    assert _count_einsums(fuse_einsums(g.graph)) == 1
+    assert _count_einsums(fuse_einsums(g.graph, cost_aware=True, contract_kwargs=contract_kwargs)) == 2
+    # With the optimal optimizer, fusing never hurts here
+    assert _count_einsums(fuse_einsums(g.graph, cost_aware=True)) == 1
+    g_opt = optimize_einsums_full(f, (a, b, c, d), contract_kwargs=contract_kwargs)
+    assert allclose(g_opt(a, b, c, d), f(a, b, c, d))
+
+
 def scalar_fusable1(x, y):
     return 7.0 * torch.einsum("ij,jk->ik", x, y / 3) / 2
 
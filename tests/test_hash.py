@@ -0,0 +1,56 @@
+import opt_einsum
+import torch
+
+from opt_einsum_fx import optimize_einsums_full
+from opt_einsum_fx import _cost
+from opt_einsum_fx._hash import _canonical_einsum
+
+
+class Block(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(4, 5, 4))
+
+    def forward(self, x, y):
+        return torch.tanh(torch.einsum("zi,ijk,zj->zk", x, self.weight, y))
+
+
+class Deep(torch.nn.Module):
+    def __init__(self, n: int):
+        super().__init__()
+        self.blocks = torch.nn.ModuleList([Block() for _ in range(n)])
+
+    def forward(self, x, y):
+        for block in self.blocks:
+            x = block(x, y)
+        return x
+
+
+def test_canonical_einsum():
+    shapes = [(3, 4), (4, 5)]
+    assert _canonical_einsum("ij,jk->ik", shapes) == _canonical_einsum("xy,yz->xz", shapes)
+    # Shapes and the order of indices are part of the key
+    assert _canonical_einsum("ij,jk->ik", shapes) != _canonical_einsum("ij,jk->ik", [(3, 4), (4, 6)])
+    assert _canonical_einsum("ij,jk->ik", shapes) != _canonical_einsum("ij,jk->ki", shapes)
+
+
+def test_repeated_blocks_searched_once(allclose, monkeypatch):
+    searches = []
+    contract_path = opt_einsum.contract_path
+
+    def counting(*args, **kwargs):
+        if isinstance(kwargs.get("optimize", None), str):
+            searches.append(args[0])
+        return contract_path(*args, **kwargs)
+
+    monkeypatch.setattr(opt_einsum, "contract_path", counting)
+    x, y = torch.randn(3, 4), torch.randn(3, 5)
+    counts = []
+    for n in (1, 4):
+        _cost._PATH_CACHE.clear()
+        searches.clear()
+        model = Deep(n)
+        g = optimize_einsums_full(model, (x, y))
+        assert allclose(g(x, y), model(x, y))
+        counts.append(len(searches))
+    assert counts[0] == counts[1]
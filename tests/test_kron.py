@@ -0,0 +1,93 @@
+import pytest
+
+import torch
+import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
+
+from opt_einsum_fx import (
+    annotate_kronecker,
+    factor_kronecker_operands,
+    optimize_einsums_full,
+    jitable,
+)
+
+
+class KronLinear(torch.nn.Module):
+    def __init__(self, weight):
+        super().__init__()
+        self.register_buffer("weight", weight)
+
+    def forward(self, x):
+        return torch.einsum("ij,zj->zi", self.weight, x)
+
+
+def _get_attrs(graph):
+    return [node.target for node in graph.nodes if node.op == "get_attr"]
+
+
+@pytest.mark.parametrize(
+    "left,right",
+    [
+        (torch.eye(4), torch.randn(3, 5)),
+        (torch.randn(2, 3), torch.randn(4, 4)),
+        (torch.randn(6, 1), torch.randn(1, 5)),
+    ],
+)
+def test_kronecker(allclose, left, right):
+    model = KronLinear(torch.kron(left, right))
+    x = torch.randn(10, left.shape[1] * right.shape[1])
+    g = optimize_einsums_full(model, (x,))
+    assert "weight" not in _get_attrs(g.graph)
+    assert allclose(g(x), model(x))
+    g_script = torch.jit.script(jitable(g))
+    assert allclose(g_script(x), model(x))
+    # The batch dimension isn't fixed by the example
+    x = torch.randn(11, x.shape[1])
+    assert allclose(g(x), model(x))
+    assert allclose(g_script(x), model(x))
+
+
+def test_kronecker_reused(allclose):
+    class Twice(torch.nn.Module):
+        def __init__(self, weight):
+            super().__init__()
+            self.register_buffer("weight", weight)
+
+        def forward(self, x):
+            x = torch.einsum("ij,zj->zi", self.weight, x).tanh()
+            return torch.einsum("ij,zj->zi", self.weight, x)
+
+    model = Twice(torch.kron(torch.randn(4, 4), torch.randn(5, 5)))
+    x = torch.randn(10, 20)
+    g = optimize_einsums_full(model, (x,))
+    assert allclose(g(x), model(x))
+    # Both einsums use the same factors
+    assert len(set(t for t in _get_attrs(g.graph) if t.startswith("_kron_"))) == 2
+
+
+def test_not_kronecker():
+    model = KronLinear(torch.randn(12, 20))
+    x = torch.randn(10, 20)
+    g = optimize_einsums_full(model, (x,))
+    assert "weight" in _get_attrs(g.graph)
+
+
+def test_annotation(allclose):
+    left, right = torch.randn(4, 4), torch.randn(3, 5)
+    weight = annotate_kronecker(torch.kron(left, right), left, right)
+    model = KronLinear(weight)
+    x = torch.randn(10, 20)
+    gm = torch.fx.symbolic_trace(model)
+    ShapeProp(gm).run(x)
+    graph = factor_kronecker_operands(gm.graph)
+    assert "weight" not in _get_attrs(graph)
+    # The given factors are used as they are
+    assert torch.equal(gm._kron_weight_left, left)
+    assert torch.equal(gm._kron_weight_right, right)
+    gm.graph = graph
+    assert allclose(gm(x), model(x))
+
+
+def test_bad_annotation():
+    with pytest.raises(ValueError):
+        annotate_kronecker(torch.randn(6, 6), torch.randn(2, 2), torch.randn(2, 2))
@@ -0,0 +1,98 @@
+import pytest
+
+import torch
+import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
+
+from opt_einsum_fx import fuse_message_passing, optimize_einsums_full, jitable
+from opt_einsum_fx._message import _gather_einsum_scatter
+
+
+class MessagePassing(torch.nn.Module):
+    def __init__(self, in_place: bool):
+        super().__init__()
+        self.in_place = in_place
+        self.weight = torch.nn.Parameter(torch.randn(3, 4, 5))
+
+    def forward(self, x, edge_attr, edge_src, edge_dst):
+        messages = torch.einsum("ei,ej,ijk->ek", x[edge_src], edge_attr, self.weight)
+        out = x.new_zeros(x.shape[0], 5)
+        if self.in_place:
+            return out.index_add_(0, edge_dst, messages)
+        return out.index_add(0, edge_dst, messages)
+
+
+def _inputs():
+    n_nodes, n_edges = 7, 40
+    return (
+        torch.randn(n_nodes, 3),
+        torch.randn(n_edges, 4),
+        torch.randint(n_nodes, (n_edges,)),
+        torch.randint(n_nodes, (n_edges,)),
+    )
+
+
+def _targets(graph):
+    return [node.target for node in graph.nodes if node.op == "call_function"]
+
+
+@pytest.mark.parametrize("in_place", [False, True])
+def test_message_passing(allclose, in_place):
+    model = MessagePassing(in_place)
+    inputs = _inputs()
+    gm = torch.fx.symbolic_trace(model)
+    ShapeProp(gm).run(*inputs)
+    gm.graph = fuse_message_passing(gm.graph, chunk_size=16)
+    assert _gather_einsum_scatter in _targets(gm.graph)
+    assert torch.einsum not in _targets(gm.graph)
+    assert allclose(gm(*inputs), model(*inputs))
+    g_script = torch.jit.script(jitable(gm))
+    assert allclose(g_script(*inputs), model(*inputs))
+
+
+def test_message_passing_full(allclose):
+    model = MessagePassing(in_place=False)
+    inputs = _inputs()
+    g = optimize_einsums_full(model, inputs)
+    assert _gather_einsum_scatter in _targets(g.graph)
+    assert allclose(g(*inputs), model(*inputs))
+    # Gradients flow through the chunks
+    g(*inputs).sum().backward()
+    grad = g.weight.grad
+    g.weight.grad = None
+    model(*inputs).sum().backward()
+    assert allclose(grad, model.weight.grad)
+
+
+def test_not_message_passing():
+    def f(x, mask, edge_dst):
+        # Boolean masks aren't gathers
+        messages = torch.einsum("ei->ei", x[mask])
+        return torch.zeros(4, 3).index_add(0, edge_dst, messages)
+
+    x = torch.randn(6, 3)
+    mask = torch.tensor([True, False, True, True, False, True])
+    edge_dst = torch.tensor([0, 1, 1, 3])
+    gm = torch.fx.symbolic_trace(f)
+    ShapeProp(gm).run(x, mask, edge_dst)
+    graph = fuse_message_passing(gm.graph)
+    assert _gather_einsum_scatter not in _targets(graph)
+
+
+def test_message_passing_hoisted(allclose):
+    def f(x, w1, w2, edge_src, edge_dst):
+        messages = torch.einsum("ei,ij,jk->ek", x[edge_src], w1, w2)
+        return torch.zeros(x.shape[0], 5).index_add(0, edge_dst, messages)
+
+    x, _, edge_src, edge_dst = _inputs()
+    w1, w2 = torch.randn(3, 4), torch.randn(4, 5)
+    inputs = (x, w1, w2, edge_src, edge_dst)
+    gm = torch.fx.symbolic_trace(f)
+    ShapeProp(gm).run(*inputs)
+    gm.graph = fuse_message_passing(gm.graph, chunk_size=16)
+    gm.recompile()
+    (node,) = [n for n in gm.graph.nodes if n.target is _gather_einsum_scatter]
+    # The weights are contracted with each other once, not for every chunk
+    n_hoisted = node.args[-2]
+    assert n_hoisted == 1
+    assert allclose(gm(*inputs), f(*inputs))
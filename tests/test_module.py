@@ -0,0 +1,106 @@
+import copy
+import pickle
+
+import pytest
+
+import torch
+
+from opt_einsum_fx import OptimizedModule
+
+
+class Model(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.weight = torch.nn.Parameter(torch.randn(4, 5))
+
+    def forward(self, x, y):
+        return torch.einsum("zi,ij,zj->z", x, self.weight, y)
+
+
+def test_optimized_module(allclose):
+    model = Model()
+    mod = OptimizedModule(model, max_variants=2)
+    assert len(list(mod.parameters())) == 1
+    for batch in (3, 7, 3):
+        x, y = torch.randn(batch, 4), torch.randn(batch, 5)
+        assert allclose(mod(x, y), model(x, y))
+    assert len(mod._variants) == 2
+    # The same signature is dispatched to the same variant
+    assert mod.variant(torch.randn(3, 4), torch.randn(3, 5)) is mod.variant(
+        torch.randn(3, 4), torch.randn(3, 5)
+    )
+
+
+def test_optimized_module_lru():
+    model = Model()
+    mod = OptimizedModule(model, max_variants=1)
+    first = mod.variant(torch.randn(2, 4), torch.randn(2, 5))
+    mod(torch.randn(6, 4), torch.randn(6, 5))
+    assert len(mod._variants) == 1
+    # The first variant was evicted, so it is optimized again
+    assert mod.variant(torch.randn(2, 4), torch.randn(2, 5)) is not first
+
+
+def test_optimized_module_strides(allclose):
+    model = Model()
+    mod = OptimizedModule(model)
+    x, y = torch.randn(3, 4), torch.randn(3, 5)
+    # Same shapes, but transposed and expanded layouts get variants of their own
+    x_t = torch.randn(4, 3).t()
+    y_expanded = torch.randn(1, 5).expand(3, 5)
+    for args in ((x, y), (x_t, y), (x, y_expanded)):
+        assert allclose(mod(*args), model(*args))
+    assert len(mod._variants) == 3
+
+
+def test_optimized_module_dtype(allclose):
+    model = Model().to(torch.float64)
+    mod = OptimizedModule(model)
+    x, y = torch.randn(3, 4, dtype=torch.float64), torch.randn(3, 5, dtype=torch.float64)
+    assert allclose(mod(x, y).float(), model(x, y).float())
+    assert len(mod._variants) == 1
+
+
+def test_optimized_module_background(allclose):
+    model = Model()
+    swapped = []
+    mod = OptimizedModule(
+        model, background=True, on_swap=lambda key, variant: swapped.append(variant)
+    )
+    x, y = torch.randn(3, 4), torch.randn(3, 5)
+    # The first call is served unoptimized while the optimization runs
+    assert allclose(mod(x, y), model(x, y))
+    mod.wait()
+    assert mod.num_swaps == 1
+    assert len(swapped) == 1
+    assert mod.variant(x, y) is swapped[0]
+    assert allclose(mod(x, y), model(x, y))
+
+
+@pytest.mark.parametrize("background", [False, True])
+def test_optimized_module_copy(allclose, background):
+    model = Model()
+    mod = OptimizedModule(model, background=background)
+    x, y = torch.randn(3, 4), torch.randn(3, 5)
+    mod(x, y)
+    for copied in (copy.deepcopy(mod), pickle.loads(pickle.dumps(mod))):
+        assert len(copied._variants) == 0
+        assert allclose(copied(x, y), model(x, y))
+        copied.wait()
+        # The copy has parameters of its own
+        assert copied.module.weight is not model.weight
+    mod.wait()
+
+
+def test_optimized_module_in_place(allclose):
+    def f(x, w):
+        x.mul_(2.0)
+        return torch.einsum("zi,ij->zj", x, w)
+
+    mod = OptimizedModule(f)
+    x, w = torch.randn(3, 4), torch.randn(4, 5)
+    expected = f(x.clone(), w)
+    # The input is only changed once, by the call itself, not by optimizing
+    x_before = x.clone()
+    assert allclose(mod(x, w), expected)
+    assert allclose(x, 2.0 * x_before)
@@ -0,0 +1,57 @@
+import torch
+import torch.fx
+from torch.fx.passes.shape_prop import ShapeProp
+
+from opt_einsum_fx import fold_permutes, optimize_einsums_full
+
+
+def _targets(graph):
+    return [
+        node.target for node in graph.nodes if node.op in ("call_function", "call_method")
+    ]
+
+
+def composed(x, y):
+    return torch.einsum("abc,dc->abd", x.permute(2, 0, 1).permute(1, 2, 0), y)
+
+
+def folded_out(x, y):
+    return torch.einsum("abc,dc->abd", x, y).permute(2, 0, 1)
+
+
+def transposed(x, y):
+    return torch.einsum("cba,dc->abd", x.transpose(0, -1), y).permute([1, 0, 2])
+
+
+def test_fold_permutes(allclose):
+    x, y = torch.randn(3, 4, 5), torch.randn(6, 5)
+    for func in (composed, folded_out, transposed):
+        g = torch.fx.symbolic_trace(func)
+        ShapeProp(g).run(x, y)
+        g.graph = fold_permutes(g.graph)
+        g.recompile()
+        targets = _targets(g.graph)
+        assert len(targets) == 1
+        assert allclose(g(x, y), func(x, y))
+
+
+def test_keep_used_permute(allclose):
+    def f(x, y):
+        xt = x.permute(1, 0)
+        return torch.einsum("ij,jk->ik", xt, y) + xt
+
+    x, y = torch.randn(3, 3), torch.randn(3, 3)
+    g = torch.fx.symbolic_trace(f)
+    g.graph = fold_permutes(g.graph)
+    g.recompile()
+    assert "permute" in _targets(g.graph)
+    assert allclose(g(x, y), f(x, y))
+
+
+def test_fold_permutes_full(allclose):
+    def f(a, b, c):
+        return torch.einsum("ij,jk,kl->li", a, b, c)
+
+    a, b, c = torch.randn(2, 30), torch.randn(30, 2), torch.randn(2, 30)
+    g = optimize_einsums_full(f, (a, b, c))
+    assert allclose(g(a, b, c), f(a, b, c))
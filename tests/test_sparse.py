@@ -0,0 +1,44 @@
+import torch
+import torch.fx
+
+from opt_einsum_fx import optimize_einsums_full, jitable
+
+
+class CGContraction(torch.nn.Module):
+    def __init__(self, density: float):
+        super().__init__()
+        cg = torch.randn(9, 5, 5)
+        cg[torch.rand(cg.shape) > density] = 0.0
+        self.register_buffer("cg", cg)
+
+    def forward(self, x, y):
+        return torch.einsum("kij,zi,zj->zk", self.cg, x, y)
+
+
+def _uses_sparse(graph):
+    return any(
+        node.op == "call_function" and node.target == torch.sparse.mm
+        for node in graph.nodes
+    )
+
+
+def test_sparse_constant(allclose):
+    model = CGContraction(density=0.05)
+    x, y = torch.randn(100, 5), torch.randn(100, 5)
+    g = optimize_einsums_full(model, (x, y))
+    assert _uses_sparse(g.graph)
+    assert allclose(g(x, y), model(x, y))
+    g_script = torch.jit.script(jitable(g))
+    assert allclose(g_script(x, y), model(x, y))
+    # The batch dimension isn't fixed by the example
+    x, y = torch.randn(101, 5), torch.randn(101, 5)
+    assert allclose(g(x, y), model(x, y))
+    assert allclose(g_script(x, y), model(x, y))
+
+
+def test_dense_constant(allclose):
+    model = CGContraction(density=1.0)
+    x, y = torch.randn(100, 5), torch.randn(100, 5)
+    g = optimize_einsums_full(model, (x, y))
+    assert not _uses_sparse(g.graph)
+    assert allclose(g(x, y), model(x, y))